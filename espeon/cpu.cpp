@@ -1,21 +1,125 @@
 #include <stdio.h>
+#include "cpu.h"
 #include "mem.h"
 #include "interrupt.h"
 #include "espeon.h"
 #include "mbc.h"
+#include "policy.h"
+#include "profiler.h"
+#include "trace.h"
 
-/* 16-bit mode */
-#define set_HL(x) do {uint32_t macro = (x); c.L = macro&0xFF; c.H = macro>>8;} while(0)
-#define set_BC(x) do {uint32_t macro = (x); c.C = macro&0xFF; c.B = macro>>8;} while(0)
-#define set_DE(x) do {uint32_t macro = (x); c.E = macro&0xFF; c.D = macro>>8;} while(0)
-#define set_AF(x) do {uint32_t macro = (x); c.F = macro&0xFF; c.A = macro>>8;} while(0)
+/* Opcode dispatch. The threaded core uses GCC labels-as-values so every
+ * handler jumps straight to the next opcode's handler instead of returning
+ * to the top of a switch. Build with -DCPU_THREADED_DISPATCH=0 to get the
+ * plain switch core back. */
+#ifndef CPU_THREADED_DISPATCH
+#if defined(__GNUC__)
+#define CPU_THREADED_DISPATCH 1
+#else
+#define CPU_THREADED_DISPATCH 0
+#endif
+#endif
 
-#define get_AF() ((c.A<<8) | c.F)
-#define get_BC() ((c.B<<8) | c.C)
-#define get_DE() ((c.D<<8) | c.E)
-#define get_HL() ((c.H<<8) | c.L)
+/* Counts executed instructions, only the host benchmark needs it */
+#ifndef CPU_INSTRUCTION_COUNTER
+#define CPU_INSTRUCTION_COUNTER 0
+#endif
+
+/* Counts executed opcode pairs for the pair report in host/pairs.cpp */
+#ifndef CPU_OPCODE_PAIRS
+#define CPU_OPCODE_PAIRS 0
+#endif
+
+/* Lazy flags. Rather than packing Z/N/H/C into F after every ALU op, the
+ * core keeps the last result and the carry bits it needs, and only builds
+ * F when something reads it (conditional jumps, ADC/SBC, DAA, PUSH AF).
+ *   f_res: bits 0-7 last result (Z), bit 8 carry (C), bit 9 N
+ *   f_h:   bit 4 is H, a^b^result of the last add/sub
+ * Build with -DCPU_LAZY_FLAGS=0 to keep F packed after every op. */
+#ifndef CPU_LAZY_FLAGS
+#define CPU_LAZY_FLAGS 1
+#endif
+
+/* Flag lookup tables for the 8-bit ALU, generated at compile time (see
+ * znc_table below). CPU_ALU_TABLES=0 computes flags with shifts and
+ * compares instead. The tables live in internal RAM by default, build with
+ * -DCPU_ALU_TABLES_IN_RAM=0 to leave them in flash and save ~1.5KB DRAM. */
+#ifndef CPU_ALU_TABLES
+#define CPU_ALU_TABLES 1
+#endif
+#ifndef CPU_ALU_TABLES_IN_RAM
+#define CPU_ALU_TABLES_IN_RAM 1
+#endif
+
+/* Pre-decoded block cache for code running from ROM, see block_lookup().
+ * Each op takes 4 bytes and each index entry 6, the defaults use ~11KB.
+ * Build with -DCPU_BLOCK_CACHE=0 to decode every instruction as it runs. */
+#ifndef CPU_BLOCK_CACHE
+#define CPU_BLOCK_CACHE 1
+#endif
+#ifndef CPU_BLOCK_CACHE_OPS
+#define CPU_BLOCK_CACHE_OPS 2048
+#endif
+#ifndef CPU_BLOCK_CACHE_BLOCKS
+#define CPU_BLOCK_CACHE_BLOCKS 512	/* power of two */
+#endif
+
+/* Superinstructions. Hot sequences in ROM blocks (see fused_length())
+ * run as one handler, chosen from the host/pairs report on real games.
+ * Needs the block cache, build with -DCPU_FUSION=0 to turn it off. */
+#ifndef CPU_FUSION
+#define CPU_FUSION CPU_BLOCK_CACHE
+#endif
+#if CPU_FUSION && !CPU_BLOCK_CACHE
+#error "CPU_FUSION needs CPU_BLOCK_CACHE"
+#endif
+#if CPU_FUSION && CPU_OPCODE_PAIRS
+#error "CPU_OPCODE_PAIRS counts single ops, build it with -DCPU_FUSION=0"
+#endif
+
+/* 16-bit mode. BC, DE and HL are native words in struct CPU (see
+ * REG_PAIR), AF is only one when flags are kept packed. */
+#if CPU_LAZY_FLAGS
+#define set_AF(x) do {uint32_t macro = (x); set_F(macro&0xFF); c.A = macro>>8;} while(0)
+#define get_AF() ((c.A<<8) | get_F())
+#else
+#define set_AF(x) c.AF = (x)
+#define get_AF() (c.AF)
+#endif
+
+/* Flags. The flags_* helpers set all flags of an 8-bit ALU op at once, r
+ * is the unmasked a+b(+carry) or a-b(-carry), or the new value for INC/DEC
+ * and logic ops. flags_or() also covers XOR and SWAP, flags_shift() is
+ * for the CB rotates and shifts, which clear N and H. */
+#if CPU_LAZY_FLAGS
+#if CPU_ALU_TABLES
+#define get_F() (znc_table[c.f_res&0x3FF] | ((c.f_h&0x10)<<1))
+#else
+#define get_F() ((!(c.f_res&0xFF))<<7 | ((c.f_res>>3)&0x40) | ((c.f_h&0x10)<<1) | ((c.f_res>>4)&0x10))
+#endif
+#define set_F(x) do {uint32_t f = (x); c.f_res = (!(f&0x80)) | (f&0x40)<<3 | (f&0x10)<<4; c.f_h = (f>>1)&0x10;} while(0)
+
+#define set_Z(x) c.f_res = ((c.f_res&~0xFFu) | !(x))
+#define set_N(x) c.f_res = ((c.f_res&~0x200u) | ((x)<<9))
+#define set_H(x) c.f_h = ((x)<<4)
+#define set_C(x) c.f_res = ((c.f_res&~0x100u) | (((x)&1)<<8))
+
+#define flag_Z (!(c.f_res&0xFF))
+#define flag_N ((c.f_res>>9)&1)
+#define flag_H ((c.f_h>>4)&1)
+#define flag_C ((c.f_res>>8)&1)
+
+#define flags_add(a, b, r) do {c.f_res = (r); c.f_h = (a)^(b)^(r);} while(0)
+#define flags_sub(a, b, r) do {c.f_res = (r) | 0x200; c.f_h = (a)^(b)^(r);} while(0)
+#define flags_inc(a, r) do {c.f_res = (c.f_res&0x100) | (r); c.f_h = (a)^(r);} while(0)
+#define flags_dec(a, r) do {c.f_res = (c.f_res&0x100) | 0x200 | (r); c.f_h = (a)^(r);} while(0)
+#define flags_and(r) do {c.f_res = (r); c.f_h = 0x10;} while(0)
+#define flags_or(r) do {c.f_res = (r); c.f_h = 0;} while(0)
+#define flags_shift(r, carry) do {c.f_res = (r) | (carry)<<8; c.f_h = 0;} while(0)
+#else
+#define get_F() (c.F)
+#define set_F(x) c.F = (x)
 
-/* Flags */
 #define set_Z(x) c.F = ((c.F&0x7F) | ((x)<<7))
 #define set_N(x) c.F = ((c.F&0xBF) | ((x)<<6))
 #define set_H(x) c.F = ((c.F&0xDF) | ((x)<<5))
@@ -26,6 +130,72 @@
 #define flag_H !!((c.F & 0x20))
 #define flag_C !!((c.F & 0x10))
 
+#if CPU_ALU_TABLES
+#define flags_add(a, b, r) c.F = znc_table[(r)&0x1FF] | ((((a)^(b)^(r))&0x10)<<1)
+#define flags_sub(a, b, r) c.F = znc_table[((r)&0x1FF) | 0x200] | ((((a)^(b)^(r))&0x10)<<1)
+#define flags_inc(a, r) c.F = (c.F&0x10) | inc_table[r]
+#define flags_dec(a, r) c.F = (c.F&0x10) | dec_table[r]
+#define flags_and(r) c.F = znc_table[r] | 0x20
+#define flags_or(r) c.F = znc_table[r]
+#define flags_shift(r, carry) c.F = znc_table[(r) | (carry)<<8]
+#else
+#define flags_add(a, b, r) c.F = ((!((r)&0xFF))<<7) | ((((a)^(b)^(r))&0x10)<<1) | (((r)>>4)&0x10)
+#define flags_sub(a, b, r) c.F = ((!((r)&0xFF))<<7) | 0x40 | ((((a)^(b)^(r))&0x10)<<1) | (((r)>>4)&0x10)
+#define flags_inc(a, r) c.F = (c.F&0x10) | ((!(r))<<7) | ((((a)^(r))&0x10)<<1)
+#define flags_dec(a, r) c.F = (c.F&0x10) | ((!(r))<<7) | 0x40 | ((((a)^(r))&0x10)<<1)
+#define flags_and(r) c.F = ((!(r))<<7) | 0x20
+#define flags_or(r) c.F = (!(r))<<7
+#define flags_shift(r, carry) c.F = (!(r))<<7 | (carry)<<4
+#endif
+#endif
+
+#if CPU_ALU_TABLES
+#if CPU_ALU_TABLES_IN_RAM
+#define ALU_TABLE_ATTR DRAM_ATTR
+#else
+#define ALU_TABLE_ATTR
+#endif
+
+/* Z, N and C from a result in f_res form: bits 0-7 result, bit 8 carry,
+ * bit 9 N. Add/sub results index it directly, logic results have bits 8-9
+ * clear. H is the only flag that needs the operands and is ORed in. */
+static constexpr uint8_t znc_flags(uint32_t r)
+{
+	return (!(r&0xFF))<<7 | ((r>>3)&0x40) | ((r>>4)&0x10);
+}
+
+#define TABLE4(f, n)	f(n), f(n+1), f(n+2), f(n+3)
+#define TABLE16(f, n)	TABLE4(f, n), TABLE4(f, n+4), TABLE4(f, n+8), TABLE4(f, n+12)
+#define TABLE64(f, n)	TABLE16(f, n), TABLE16(f, n+16), TABLE16(f, n+32), TABLE16(f, n+48)
+#define TABLE256(f, n)	TABLE64(f, n), TABLE64(f, n+64), TABLE64(f, n+128), TABLE64(f, n+192)
+
+static constexpr uint8_t ALU_TABLE_ATTR znc_table[1024] = {
+	TABLE256(znc_flags, 0), TABLE256(znc_flags, 256),
+	TABLE256(znc_flags, 512), TABLE256(znc_flags, 768)
+};
+
+#if !CPU_LAZY_FLAGS
+/* Z and H of INC, Z, N and H of DEC, indexed by the new value */
+static constexpr uint8_t inc_flags(uint32_t r)
+{
+	return (!r)<<7 | ((r&0xF) == 0)<<5;
+}
+
+static constexpr uint8_t dec_flags(uint32_t r)
+{
+	return (!r)<<7 | 0x40 | ((r&0xF) == 0xF)<<5;
+}
+
+static constexpr uint8_t ALU_TABLE_ATTR inc_table[256] = { TABLE256(inc_flags, 0) };
+static constexpr uint8_t ALU_TABLE_ATTR dec_table[256] = { TABLE256(dec_flags, 0) };
+#endif
+
+#undef TABLE4
+#undef TABLE16
+#undef TABLE64
+#undef TABLE256
+#endif
+
 static const uint8_t opcycles[] = {
 /*  0  1  2  3  4  5  6  7		8  9  A  B  C  D  E  F	*/
 	1, 3, 2, 2, 1, 1, 2, 1, 	5, 2, 2, 2, 1, 1, 2, 1, // 0
@@ -47,17 +217,38 @@ static const uint8_t opcycles[] = {
 	3, 3, 2, 1, 0, 4, 2, 4, 	3, 2, 4, 1, 0, 0, 2, 4  // F
 };
 
+/* A register pair readable as one 16-bit word or as its two halves. The
+ * high register sits at the higher address on little-endian hosts (Xtensa,
+ * x86) and at the lower one on big-endian hosts. */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REG_PAIR(hi, lo) union { uint16_t hi##lo; struct { uint8_t hi, lo; }; }
+#else
+#define REG_PAIR(hi, lo) union { uint16_t hi##lo; struct { uint8_t lo, hi; }; }
+#endif
+
 struct CPU {
-	uint8_t H, L;
-	uint8_t D, E;
-	uint8_t B, C;
-	uint8_t A, F;
+	REG_PAIR(H, L);
+	REG_PAIR(D, E);
+	REG_PAIR(B, C);
+	REG_PAIR(A, F);	/* F and AF are only used with CPU_LAZY_FLAGS=0 */
 
 	uint16_t SP;
 	uint16_t PC;
 
+#if CPU_LAZY_FLAGS
+	uint32_t f_res;
+	uint8_t f_h;
+#endif
+
 	uint32_t cycles;
 	uint32_t lastcycles;
+	uint32_t target;
+	uint8_t bus;	/* M-cycles into the instruction, with mcycle_timing */
+	uint64_t halt_skipped;
+	uint64_t idle_skipped;
+#if CPU_INSTRUCTION_COUNTER
+	uint32_t instructions;
+#endif
 };
 
 static struct CPU c;
@@ -68,21 +259,26 @@ void cpu_init(void)
 {	
 	// Initialize CPU cycles counter
 	c.cycles = 0;
+	c.halt_skipped = 0;
+	c.idle_skipped = 0;
 	c.lastcycles = 0;
+	cpu_flush_blocks();
 	
 	// Initialize interrupt system
 	IME = 0;  // Interrupts disabled initially
 	IF = 0;   // No pending interrupts
 	IE = 0;   // No interrupts enabled initially
+	ime_delay = 0;
+	interrupt_update();
 	halted = false;
 	
 	if (usebootrom) {
 		// Bootrom mode: Start execution at 0x0000 where bootrom is loaded
 		// Initialize with minimal values for bootrom execution
 		set_AF(0x0000);  // A=0x00, F=0x00
-		set_BC(0x0000);  // B=0x00, C=0x00
-		set_DE(0x0000);  // D=0x00, E=0x00
-		set_HL(0x0000);  // H=0x00, L=0x00
+		c.BC = 0x0000;  // B=0x00, C=0x00
+		c.DE = 0x0000;  // D=0x00, E=0x00
+		c.HL = 0x0000;  // H=0x00, L=0x00
 		c.SP = 0xFFFE;   // Stack pointer at top of RAM
 		c.PC = 0x0000;   // Start at bootrom entry point
 		Serial.println("CPU: Initialized for bootrom mode (PC=0x0000)");
@@ -91,983 +287,1073 @@ void cpu_init(void)
 	
 	// Normal mode: Skip bootrom, start at ROM entry point with post-bootrom values
 	set_AF(0x01B0);
-	set_BC(0x0013);
-	set_DE(0x00D8);
-	set_HL(0x014D);
+	c.BC = 0x0013;
+	c.DE = 0x00D8;
+	c.HL = 0x014D;
 	c.SP = 0xFFFE;
 	c.PC = 0x0100;
 	
 	// Enable basic interrupts for normal operation
 	IE = 0x1F; // Enable all interrupts (VBlank, LCD STAT, Timer, Serial, Joypad)
 	IME = 1; // Enable interrupt master enable
+	interrupt_update();
 	
 	Serial.println("CPU: Initialized for normal mode (PC=0x0100)");
 }
 
-static void RLC(uint8_t reg)
-{
-	uint8_t t, old;
+/* The interpreter, specialised at compile time by one of the accuracy
+ * policies in policy.h. cpu_run() runs Core<CpuPolicy>. */
+template<class P>
+struct Core {
+	static uint32_t run(uint32_t cycle_budget);
 
-	switch(reg)
+	/* Data accesses of the running instruction. With M-cycle timing c.bus
+	 * starts at the M-cycle of its first access (bus_offset[]) and moves
+	 * on with every access, so cpu_get_cycles() gives I/O registers the
+	 * cycle they are actually touched on. */
+	static inline uint8_t bus_read(uint16_t a)
 	{
-		case 0:	/* B */
-			old = !!(c.B&0x80);
-			c.B = (c.B << 1) | old;
-			set_C(old);
-			set_Z(!c.B);
-		break;
-		case 1:	/* C */
-			old = !!(c.C&0x80);
-			set_C(old);
-			c.C = c.C<<1 | old;
-			set_Z(!c.C);
-		break;
-		case 2:	/* D */
-			old = !!(c.D&0x80);
-			set_C(old);
-			c.D = c.D<<1 | old;
-			set_Z(!c.D);
-		break;
-		case 3:	/* E */
-			old = !!(c.E&0x80);
-			set_C(old);
-			c.E = c.E<<1 | old;
-			set_Z(!c.E);
-		break;
-		case 4:	/* H */
-			old = !!(c.H&0x80);
-			set_C(old);
-			c.H = c.H<<1 | old;
-			set_Z(!c.H);
-		break;
-		case 5:	/* L */
-			old = !!(c.L&0x80);
-			set_C(old);
-			c.L = c.L<<1 | old;
-			set_Z(!c.L);
-		break;
-		case 6:	/* (HL) */
-			t = mem_get_byte(get_HL());
-			old = !!(t&0x80);
-			set_C(old);
-			t = t<<1 | old;
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-			c.cycles += 2;
-		break;
-		case 7:	/* A */
-			old = !!(c.A&0x80);
-			c.A = (c.A<<1) | old;
-			set_C(old);
-			set_Z(!c.A);
-		break;
+		uint8_t v = mem_get_byte(a);
+		if (P::mcycle_timing)
+			c.bus++;
+		return v;
 	}
 
-	set_N(0);
-	set_H(0);
-}
+	static inline void bus_write(uint16_t a, uint8_t v)
+	{
+		mem_write_byte(a, v);
+		if (P::mcycle_timing)
+			c.bus++;
+	}
 
-static void RRC(uint8_t reg)
+	static inline uint16_t bus_read16(uint16_t a)
+	{
+		uint8_t lo = bus_read(a);
+		return lo | bus_read(a + 1) << 8;
+	}
+
+	static inline void bus_write16(uint16_t a, uint16_t v)
+	{
+		bus_write(a, v & 0xFF);
+		bus_write(a + 1, v >> 8);
+	}
+};
+
+/* CB-prefixed ops. Each of the 256 opcodes is its own instance of
+ * cb_op<P, OP, BIT, REG>, so the operation and operand are fixed at
+ * compile time and decoding is a single lookup in cb_ops<P>::table. REG
+ * follows the opcode encoding: B, C, D, E, H, L, (HL), A. The 0xCB
+ * handler adds the cycles. */
+enum {
+	CB_RLC, CB_RRC, CB_RL, CB_RR, CB_SLA, CB_SRA, CB_SWAP, CB_SRL,
+	CB_BIT, CB_RES, CB_SET
+};
+
+template<class P, int REG>
+static inline uint8_t cb_read(void)
 {
-	uint8_t t, old;
+	switch(REG)
+	{
+		case 0: return c.B;
+		case 1: return c.C;
+		case 2: return c.D;
+		case 3: return c.E;
+		case 4: return c.H;
+		case 5: return c.L;
+		case 6: return Core<P>::bus_read(c.HL);
+		default: return c.A;
+	}
+}
 
-	switch(reg)
+template<class P, int REG>
+static inline void cb_write(uint8_t t)
+{
+	switch(REG)
 	{
-		case 0:	/* B */
-			old = c.B&1;
-			set_C(old);
-			c.B = c.B>>1 | old<<7;
-			set_Z(!c.B);
-		break;
-		case 1:	/* C */
-			old = c.C&1;
-			set_C(old);
-			c.C = c.C>>1 | old<<7;
-			set_Z(!c.C);
-		break;
-		case 2:	/* D */
-			old = c.D&1;
-			set_C(old);
-			c.D = c.D>>1 | old<<7;
-			set_Z(!c.D);
-		break;
-		case 3:	/* E */
-			old = c.E&1;
-			set_C(old);
-			c.E = c.E>>1 | old<<7;
-			set_Z(!c.E);
-		break;
-		case 4:	/* H */
-			old = c.H&1;
-			set_C(old);
-			c.H = c.H>>1 | old<<7;
-			set_Z(!c.H);
-		break;
-		case 5:	/* L */
-			old = c.L&1;
-			set_C(old);
-			c.L = c.L>>1 | old<<7;
-			set_Z(!c.L);
-		break;
-		case 6:	/* (HL) */
-			t = mem_get_byte(get_HL());
-			old = t;
-			set_C(old);
-			t = t>>1 | old<<7;
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-			c.cycles += 2;
-		break;
-		case 7:	/* A */
-			old = c.A&1;
-			set_C(old);
-			c.A = c.A>>1 | old<<7;
-			set_Z(!c.A);
-		break;
+		case 0: c.B = t; break;
+		case 1: c.C = t; break;
+		case 2: c.D = t; break;
+		case 3: c.E = t; break;
+		case 4: c.H = t; break;
+		case 5: c.L = t; break;
+		case 6: Core<P>::bus_write(c.HL, t); break;
+		default: c.A = t; break;
 	}
-	set_N(0);
-	set_H(0);
 }
 
-static void RL(uint8_t reg)
+template<class P, int OP, int BIT, int REG>
+static void cb_op(void)
 {
-	uint8_t t, t2;
+	uint8_t t = cb_read<P, REG>();
+	uint8_t carry;
 
-	switch(reg)
+	switch(OP)
 	{
-		case 0: /* B */
-			t2 = flag_C;
-			set_C(!!(c.B&0x80));
-			c.B = (c.B << 1) | !!(t2);
-			set_Z(!c.B);
-		break;
-		case 1: /* C */
-			t2 = flag_C;
-			set_C(!!(c.C&0x80));
-			c.C = (c.C << 1) | !!(t2);
-			set_Z(!c.C);
-		break;
-		case 2: /* D */
-			t2 = flag_C;
-			set_C(!!(c.D&0x80));
-			c.D = (c.D << 1) | !!(t2);
-			set_Z(!c.D);
-		break;
-		case 3: /* E */
-			t2 = flag_C;
-			set_C(!!(c.E&0x80));
-			c.E = (c.E << 1) | !!(t2);
-			set_Z(!c.E);
-		break;
-		case 4: /* H */
-			t2 = flag_C;
-			set_C(!!(c.H&0x80));
-			c.H = (c.H << 1) | !!(t2);
-			set_Z(!c.H);
-		break;
-		case 5: /* L */
-			t2 = flag_C;
-			set_C(!!(c.L&0x80));
-			c.L = (c.L << 1) | !!(t2);
-			set_Z(!c.L);
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			t2 = flag_C;
-			set_C(!!(t&0x80));
-			t = (t << 1) | !!(t2);
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-			c.cycles += 2;
+		case CB_RLC:
+			carry = t>>7;
+			t = t<<1 | carry;
+			flags_shift(t, carry);
+		break;
+		case CB_RRC:
+			carry = t&1;
+			t = t>>1 | carry<<7;
+			flags_shift(t, carry);
+		break;
+		case CB_RL:
+			carry = t>>7;
+			t = t<<1 | flag_C;
+			flags_shift(t, carry);
+		break;
+		case CB_RR:
+			carry = t&1;
+			t = t>>1 | flag_C<<7;
+			flags_shift(t, carry);
+		break;
+		case CB_SLA:
+			carry = t>>7;
+			t = t<<1;
+			flags_shift(t, carry);
+		break;
+		case CB_SRA:
+			carry = t&1;
+			t = t>>1 | (t&0x80);
+			flags_shift(t, carry);
+		break;
+		case CB_SWAP:
+			t = t<<4 | t>>4;
+			flags_or(t);
+		break;
+		case CB_SRL:
+			carry = t&1;
+			t = t>>1;
+			flags_shift(t, carry);
+		break;
+		case CB_BIT:
+			set_Z(!(t & (1<<BIT)));
+			set_N(0);
+			set_H(1);
+		return;
+		case CB_RES:
+			t &= ~(1<<BIT);
 		break;
-		case 7: /* A */
-			t2 = flag_C;
-			set_C(!!(c.A&0x80));
-			c.A = (c.A << 1) | t2;
-			set_Z(!c.A);
+		case CB_SET:
+			t |= 1<<BIT;
 		break;
 	}
 
-	set_N(0);
-	set_H(0);
+	cb_write<P, REG>(t);
 }
 
-static void RR(uint8_t reg)
+#define CB_ROW(op, bit) \
+	&cb_op<P, op, bit, 0>, &cb_op<P, op, bit, 1>, &cb_op<P, op, bit, 2>, &cb_op<P, op, bit, 3>, \
+	&cb_op<P, op, bit, 4>, &cb_op<P, op, bit, 5>, &cb_op<P, op, bit, 6>, &cb_op<P, op, bit, 7>
+#define CB_ROWS(op) \
+	CB_ROW(op, 0), CB_ROW(op, 1), CB_ROW(op, 2), CB_ROW(op, 3), \
+	CB_ROW(op, 4), CB_ROW(op, 5), CB_ROW(op, 6), CB_ROW(op, 7)
+
+template<class P>
+struct cb_ops {
+	static void (* const table[256])(void);
+};
+
+template<class P>
+void (* const cb_ops<P>::table[256])(void) = {
+	CB_ROW(CB_RLC, 0), CB_ROW(CB_RRC, 0), CB_ROW(CB_RL, 0), CB_ROW(CB_RR, 0),
+	CB_ROW(CB_SLA, 0), CB_ROW(CB_SRA, 0), CB_ROW(CB_SWAP, 0), CB_ROW(CB_SRL, 0),
+	CB_ROWS(CB_BIT),
+	CB_ROWS(CB_RES),
+	CB_ROWS(CB_SET)
+};
+
+#undef CB_ROW
+#undef CB_ROWS
+
+static inline void block_unchain(void);
+
+void cpu_interrupt(uint16_t vector)
 {
-	uint8_t t, t2;
+	c.SP -= 2;
+	/* PC is pushed after two wait cycles */
+	if (CpuPolicy::mcycle_timing)
+		c.bus = 2;
+	Core<CpuPolicy>::bus_write16(c.SP, c.PC);
+	if (CpuPolicy::mcycle_timing)
+		c.bus = 0;
+	c.PC = vector;
+	block_unchain();
+	c.cycles += 5 + halted;
+	halted = 0;
+}
 
-	switch(reg)
-	{
-		case 0:	/* B */
-			t2 = flag_C;
-			set_C(c.B&1);
-			c.B = (c.B >> 1) | t2<<7;
-			set_Z(!c.B);
-		break;
-		case 1: /* C */
-			t2 = flag_C;
-			set_C(c.C&1);
-			c.C = (c.C >> 1) | t2<<7;
-			set_Z(!c.C);
-		break;
-		case 2: /* D */
-			t2 = flag_C;
-			set_C(c.D&1);
-			c.D = (c.D >> 1) | t2<<7;
-			set_Z(!c.D);
-		break;
-		case 3: /* E */
-			t2 = flag_C;
-			set_C(c.E&1);
-			c.E = (c.E >> 1) | t2<<7;
-			set_Z(!c.E);
-		break;
-		case 4: /* H */
-			t2 = flag_C;
-			set_C(c.H&1);
-			c.H = (c.H >> 1) | t2<<7;
-			set_Z(!c.H);
-		break;
-		case 5: /* L */
-			t2 = flag_C;
-			set_C(c.L&1);
-			c.L = (c.L >> 1) | t2<<7;
-			set_Z(!c.L);
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			t2 = flag_C;
-			set_C(t&1);
-			t = (t >> 1) | t2<<7;
-			set_Z(!t);
-			mem_write_byte(get_HL(), t);
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			t2 = flag_C;
-			set_C(c.A&1);
-			c.A = (c.A >> 1) | (t2<<7);
-			set_Z(!c.A);
-		break;
-	}
-	set_N(0);
-	set_H(0);
+uint32_t cpu_get_cycles(void)
+{
+	if (CpuPolicy::mcycle_timing)
+		return c.cycles + c.bus;
+	return c.cycles;
 }
 
-static void SLA(uint8_t reg)
+uint16_t cpu_get_pc(void)
 {
-	uint8_t t;
+	return c.PC;
+}
 
-	switch(reg)
-	{
-		case 0: /* B */
-			set_C(!!(c.B & 0x80));
-			c.B = c.B << 1;
-			set_Z(!c.B);
-		break;
-		case 1: /* C */
-			set_C(!!(c.C & 0x80));
-			c.C = c.C << 1;
-			set_Z(!c.C);
-		break;
-		case 2: /* D */
-			set_C(!!(c.D & 0x80));
-			c.D = c.D << 1;
-			set_Z(!c.D);
-		break;
-		case 3: /* E */
-			set_C(!!(c.E & 0x80));
-			c.E = c.E << 1;
-			set_Z(!c.E);
-		break;
-		case 4: /* H */
-			set_C(!!(c.H & 0x80));
-			c.H = c.H << 1;
-			set_Z(!c.H);
-		break;
-		case 5: /* L */
-			set_C(!!(c.L & 0x80));
-			c.L = c.L << 1;
-			set_Z(!c.L);
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			set_C(!!(t & 0x80));
-			t = t << 1;
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			set_C(!!(c.A & 0x80));
-			c.A = c.A << 1;
-			set_Z(!c.A);
-		break;
-	}
+uint64_t cpu_get_halt_skipped_cycles(void)
+{
+	return c.halt_skipped;
+}
 
-	set_H(0);
-	set_N(0);
+uint64_t cpu_get_idle_skipped_cycles(void)
+{
+	return c.idle_skipped;
 }
 
-static void SRA(uint8_t reg)
+uint32_t cpu_get_instruction_count(void)
 {
-	uint8_t old, t;
+#if CPU_INSTRUCTION_COUNTER
+	return c.instructions;
+#else
+	return 0;
+#endif
+}
 
-	switch(reg)
-	{
-		case 0: /* B */
-			set_C(c.B&1);
-			old = c.B&0x80;
-			c.B = c.B >> 1 | old;
-			set_Z(!c.B);
-		break;
-		case 1: /* C */
-			set_C(c.C&1);
-			old = c.C&0x80;
-			c.C = c.C >> 1 | old;
-			set_Z(!c.C);
-		break;
-		case 2: /* D */
-			set_C(c.D&1);
-			old = c.D&0x80;
-			c.D = c.D >> 1 | old;
-			set_Z(!c.D);
-		break;
-		case 3: /* E */
-			set_C(c.E&1);
-			old = c.E&0x80;
-			c.E = c.E >> 1 | old;
-			set_Z(!c.E);
-		break;
-		case 4: /* H */
-			set_C(c.H&1);
-			old = c.H&0x80;
-			c.H = c.H >> 1 | old;
-			set_Z(!c.H);
-		break;
-		case 5: /* L */
-			set_C(c.L&1);
-			old = c.L&0x80;
-			c.L = c.L >> 1 | old;
-			set_Z(!c.L);
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			set_C(t&1);
-			old = t&0x80;
-			t = t >> 1 | old;
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			set_C(c.A&1);
-			old = c.A&0x80;
-			c.A = c.A >> 1 | old;
-			set_Z(!c.A);
-		break;
+void cpu_print_debug(void)
+{
+	printf("%04X: %02X\n", c.PC, mem_get_byte(c.PC));
+	printf("\tAF: %02X%02X, BC: %02X%02X, DE: %02X%02X, HL: %02X%02X SP: %04X, cycles %d\n",
+		c.A, get_F(), c.B, c.C, c.D, c.E, c.H, c.L, c.SP, c.cycles);
+}
+
+/* Instruction fetch cache. Opcodes and immediates are read through a host
+ * pointer to the memory region holding PC (a run of contiguously mapped
+ * pages, e.g. ROM bank 0, the current ROM bank or WRAM, or HRAM) instead of
+ * going through mem_get_byte(). The pointer aliases the emulated memory, so
+ * writes to RAM are seen right away, mem.cpp only has to flush it when the
+ * page table changes (bank switches, OAM DMA). */
+static struct {
+	const uint8_t* base;	/* host address of lo */
+	uint16_t lo;
+	uint16_t len;		/* 0 while nothing is cached */
+} fetch;
+
+void cpu_flush_fetch(void)
+{
+	fetch.len = 0;
+	block_unchain();
+}
+
+static uint8_t fetch_refill(uint16_t a)
+{
+	int first = a >> 8, last = a >> 8;
+	const uint8_t* page = mem_read_map[first];
+
+	if (!page) {
+		/* HRAM is executable and not affected by OAM DMA */
+		if (a >= 0xFF80 && a < 0xFFFF) {
+			fetch.base = mem_hram;
+			fetch.lo = 0xFF80;
+			fetch.len = 0x7F;
+			return fetch.base[a - fetch.lo];
+		}
+		return mem_get_byte_slow(a);
 	}
 
-	set_H(0);
-	set_N(0);
+	while (first > 0 && mem_read_map[first-1] == mem_read_map[first] - 0x100)
+		first--;
+	while (last < 0xFF && mem_read_map[last+1] == mem_read_map[last] + 0x100)
+		last++;
+
+	fetch.base = mem_read_map[first];
+	fetch.lo = first << 8;
+	fetch.len = (last - first + 1) << 8;
+	return page[a & 0xFF];
 }
 
-static void SRL(uint8_t reg)
+static inline uint8_t fetch_byte(uint16_t a)
 {
-	uint8_t t;
+	uint16_t off = a - fetch.lo;
+	if (off < fetch.len)
+		return fetch.base[off];
+	return fetch_refill(a);
+}
 
-	switch(reg)
-	{
-		case 0: /* B */
-			set_C(c.B & 1);
-			c.B = c.B >> 1;
-			set_Z(!c.B);
-		break;
-		case 1: /* C */
-			set_C(c.C & 1);
-			c.C = c.C >> 1;
-			set_Z(!c.C);
-		break;
-		case 2: /* D */
-			set_C(c.D & 1);
-			c.D = c.D >> 1;
-			set_Z(!c.D);
-		break;
-		case 3: /* E */
-			set_C(c.E & 1);
-			c.E = c.E >> 1;
-			set_Z(!c.E);
-		break;
-		case 4: /* H */
-			set_C(c.H & 1);
-			c.H = c.H >> 1;
-			set_Z(!c.H);
-		break;
-		case 5: /* L */
-			set_C(c.L & 1);
-			c.L = c.L >> 1;
-			set_Z(!c.L);
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			set_C(t & 1);
-			t = t >> 1;
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			set_C(c.A & 1);
-			c.A = c.A >> 1;
-			set_Z(!c.A);
-		break;
+static inline uint16_t fetch_word(uint16_t a)
+{
+	uint16_t off = a - fetch.lo;
+	if (off + 1 < fetch.len)
+		return fetch.base[off] | (fetch.base[off+1] << 8);
+	return fetch_byte(a) | (fetch_byte(a+1) << 8);
+}
+
+/* Idle loops. Games wait for a given LY, STAT mode or IF bit with loops
+ * like
+ *   LDH A,(FF44) ; CP n         ; JR NZ,loop
+ *   LDH A,(FF41) ; AND 3        ; JR NZ,loop
+ *   LDH A,(FF41) ; AND 3 ; CP n ; JR NZ,loop
+ * Those registers only change on LCD/timer events, and gb_run() ends the
+ * batch at every event, so after one pass through the loop every further
+ * pass until the end of the batch reads the same value, leaves the same
+ * A and flags and takes the branch again. Called on the taken JR that
+ * closes such a loop, this skips the whole passes that fit before the
+ * batch target, the rest runs normally so the batch ends on the same
+ * cycle it would have without skipping. */
+static void idle_loop_skip(uint16_t start, uint16_t jr)
+{
+	uint32_t pass = 3 + 2 + 3;	/* LDH, CP/AND, taken JR */
+	uint16_t pc = start + 4;
+	uint8_t reg;
+
+	if (fetch_byte(start) != 0xF0)
+		return;
+	reg = fetch_byte(start + 1);
+	if (reg != 0x44 && reg != 0x41 && reg != 0x0F)
+		return;
+
+	switch (fetch_byte(start + 2)) {
+		case 0xFE:	/* CP imm8 */
+			break;
+		case 0xE6:	/* AND imm8, optionally followed by CP imm8 */
+			if (pc != jr && fetch_byte(pc) == 0xFE) {
+				pc += 2;
+				pass += 2;
+			}
+			break;
+		default:
+			return;
 	}
 
-	set_H(0);
-	set_N(0);
+	/* During OAM DMA the read returns the byte being transferred */
+	if (pc != jr || mem_dma_active())
+		return;
+
+	/* The pass that just ended must have read the register in this batch,
+	 * c.lastcycles is where the batch started */
+	if ((int32_t)(c.cycles - pass - c.lastcycles) < 0)
+		return;
+
+	int32_t left = c.target - c.cycles;
+	if (left < (int32_t)pass)
+		return;
+
+	uint32_t skip = left / pass * pass;
+	c.cycles += skip;
+	c.idle_skipped += skip;
 }
 
-static void SWAP(uint8_t reg)
+/* Taken conditional JR. The backward jumps that close the loops above
+ * are 6 or 8 bytes. */
+static inline void jr_taken(uint8_t off)
 {
-	uint8_t t;
+	c.PC += (signed char)off;
+	c.cycles += 3;
+	if (off == 0xFA || off == 0xF8)
+		idle_loop_skip(c.PC, c.PC - (signed char)off - 2);
+}
 
-	switch(reg)
-	{
-		case 0: /* B */
-			c.B = ((c.B&0xF)<<4) | ((c.B&0xF0)>>4);
-			c.F = (!c.B)<<7;
-		break;
-		case 1: /* C */
-			c.C = ((c.C&0xF)<<4) | ((c.C&0xF0)>>4);
-			c.F = (!c.C)<<7;
-		break;
-		case 2: /* D */
-			c.D = ((c.D&0xF)<<4) | ((c.D&0xF0)>>4);
-			c.F = (!c.D)<<7;
-		break;
-		case 3: /* E */
-			c.E = ((c.E&0xF)<<4) | ((c.E&0xF0)>>4);
-			c.F = (!c.E)<<7;
-		break;
-		case 4: /* H */
-			c.H = ((c.H&0xF)<<4) | ((c.H&0xF0)>>4);
-			c.F = (!c.H)<<7;
-		break;
-		case 5: /* L */
-			c.L = ((c.L&0xF)<<4) | ((c.L&0xF0)>>4);
-			c.F = (!c.L)<<7;
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			t = ((t&0xF)<<4) | ((t&0xF0)>>4);
-			mem_write_byte(get_HL(), t);
-			c.F = (!t)<<7;
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			c.A = ((c.A&0xF)<<4) | ((c.A&0xF0)>>4);
-			c.F = (!c.A)<<7;
-		break;
+/* Wakes the CPU if an interrupt is pending, otherwise fast-forwards to the
+ * end of the batch. Interrupts are only raised by the peripherals, which
+ * run between batches, and gb_run() ends every batch at the next
+ * scheduled event, so nothing can wake the CPU before that.
+ * Returns true while the CPU stays halted. */
+static inline bool cpu_halt_idle(void)
+{
+	if (interrupt_flush()) {
+		halted = 0;
+		return false;
 	}
+	c.halt_skipped += c.target - c.cycles;
+	c.cycles = c.target;
+	return true;
 }
 
-static void BIT_(uint8_t bit, uint8_t reg)
+/* Instruction lengths. The opcode and its immediate are decoded together,
+ * handlers find the operand in imm (IMM8/IMM16) with PC already past it. */
+static const uint8_t op_length[256] = {
+	1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+	1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+};
+
+/* M-cycle of the first data access of each opcode, counting the opcode
+ * fetch as 0. Later accesses of the same instruction follow one per
+ * M-cycle. Only used with mcycle_timing. */
+static const uint8_t bus_offset[256] = {
+	0, 0, 1, 0, 0, 0, 0, 0, 3, 0, 1, 0, 0, 0, 0, 0,
+	0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0,
+	0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0,
+	0, 0, 1, 0, 1, 1, 2, 0, 0, 0, 1, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0,
+	0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0,
+	0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0,
+	1, 1, 1, 1, 1, 1, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0,
+	0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0,
+	0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0,
+	0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0,
+	0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0,
+	2, 1, 0, 0, 4, 2, 0, 2, 2, 1, 0, 2, 4, 4, 0, 2,
+	2, 1, 0, 0, 4, 2, 0, 2, 2, 1, 0, 0, 4, 0, 0, 2,
+	2, 1, 1, 0, 0, 2, 0, 2, 0, 0, 3, 0, 0, 0, 0, 2,
+	2, 1, 1, 0, 0, 2, 0, 2, 0, 0, 3, 0, 0, 0, 0, 2,
+};
+
+#define IMM8	((uint8_t)imm)
+#define IMM16	(imm)
+
+/* Decodes the instruction at PC straight from memory. On the HALT bug PC
+ * doesn't advance past the opcode, so it is read again as the first
+ * operand byte. */
+template<class P>
+static inline uint8_t decode_op(uint16_t* imm)
 {
-	uint8_t t, f = 0 /* Make GCC happy */;
+	uint16_t pc = c.PC;
+	uint8_t b = fetch_byte(pc);
+	uint8_t len = op_length[b];
 
-	switch(reg)
-	{
-		case 0: /* B */
-		    f = !(c.B & bit);
-		break;
-		case 1: /* C */
-		    f = !(c.C & bit);
-		break;
-		case 2: /* D */
-		    f = !(c.D & bit);
-		break;
-		case 3: /* E */
-		    f = !(c.E & bit);
-		break;
-		case 4: /* H */
-		    f = !(c.H & bit);
-		break;
-		case 5: /* L */
-		    f = !(c.L & bit);
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			f = !(t & bit);
-			c.cycles += 1;
-		break;
-		case 7: /* A */
-		    f = !(c.A & bit);
-		break;
+	if (P::halt_bug && halt_bug)
+		halt_bug = false;
+	else
+		pc++;
+
+	if (len > 1)
+		*imm = len > 2 ? fetch_word(pc) : fetch_byte(pc);
+	c.PC = pc + len - 1;
+	return b;
+}
+
+/* decode_op() for the fetch, also points c.bus at the first access */
+template<class P>
+static inline uint8_t decode_bus_op(uint16_t* imm)
+{
+	uint8_t b = decode_op<P>(imm);
+	if (P::mcycle_timing)
+		c.bus = bus_offset[b];
+	return b;
+}
+
+#if CPU_BLOCK_CACHE
+/* Block cache. ROM code is decoded once into runs of ops (opcode, length,
+ * immediate) that end at the first jump, call, return, RST or HALT.
+ * Blocks are keyed by (ROM bank, address), so bank switches need no
+ * invalidation. Code in RAM is never cached and decodes as it runs, which
+ * keeps self-modifying code in WRAM/HRAM correct. When the op pool is
+ * full the whole cache is dropped and refilled. Handlers still add their
+ * own cycles, conditional branches and the CB ops make the cost depend on
+ * more than the opcode. */
+#define BLOCK_MAX_OPS	32
+#define BLOCK_NONE	0xFFFF
+#define UOP_LEN		0x03
+#define UOP_FUSED	0x40	/* first op of a fused sequence */
+#define UOP_LAST	0x80
+
+struct uop {
+	uint8_t op;
+	uint8_t info;	/* length, UOP_FUSED, UOP_LAST on the last op of a block */
+	uint16_t imm;
+};
+
+struct block_entry {
+	uint16_t addr;
+	uint16_t bank;
+	uint16_t first;	/* index into ops[], BLOCK_NONE if unused */
+};
+
+/* Stand-in for cur between blocks, flagged last so the next fetch looks up */
+static const struct uop no_block = { 0, UOP_LAST, 0 };
+
+static struct {
+	struct uop ops[CPU_BLOCK_CACHE_OPS];
+	struct block_entry index[CPU_BLOCK_CACHE_BLOCKS];
+	uint16_t used;
+	const struct uop* cur;	/* op being executed, no_block outside a block */
+	uint32_t hits;
+	uint32_t misses;
+} blocks;
+
+/* Makes the next fetch look its block up again, for bank switches */
+static inline void block_unchain(void)
+{
+	blocks.cur = &no_block;
+}
+
+void cpu_flush_blocks(void)
+{
+	for (int i = 0; i < CPU_BLOCK_CACHE_BLOCKS; i++)
+		blocks.index[i].first = BLOCK_NONE;
+	blocks.used = 0;
+	blocks.cur = &no_block;
+}
+
+/* Every op that can move PC ends its block, so the next op of a block is
+ * always the next instruction. Only interrupts and bank switches need to
+ * break the chain (block_unchain()). */
+static inline bool op_ends_block(uint8_t b)
+{
+	switch (b) {
+		case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:	/* JR */
+		case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:	/* JP */
+		case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:	/* CALL */
+		case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8:	/* RET */
+		case 0xD9: case 0xE9: case 0x76: case 0x10:	/* RETI, JP HL, HALT, STOP */
+			return true;
 	}
+	return (b & 0xC7) == 0xC7;	/* RST */
+}
 
-	set_Z(f);
-	set_N(0);
-	set_H(1);
+static inline struct block_entry* block_entry_for(uint16_t pc, uint16_t bank)
+{
+	return &blocks.index[(pc ^ (pc >> 9) ^ (bank << 3)) & (CPU_BLOCK_CACHE_BLOCKS - 1)];
 }
 
-static void RES(uint8_t bit, uint8_t reg)
+#if CPU_FUSION
+static inline bool is_jr_cc(uint8_t b)
 {
-	uint8_t t;
+	return b == 0x20 || b == 0x28 || b == 0x30 || b == 0x38;
+}
 
-	switch(reg)
-	{
-		case 0: /* B */
-			c.B &= ~bit;
-		break;
-		case 1: /* C */
-			c.C &= ~bit;
-		break;
-		case 2: /* D */
-			c.D &= ~bit;
-		break;
-		case 3: /* E */
-			c.E &= ~bit;
-		break;
-		case 4: /* H */
-			c.H &= ~bit;
-		break;
-		case 5: /* L */
-			c.L &= ~bit;
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			t &= ~bit;
-			mem_write_byte(get_HL(), t);
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			c.A &= ~bit;
-		break;
+/* Length of the fused sequence starting at u, 0 if there is none. n is
+ * the number of ops left in the block. The set comes from host/pairs on
+ * Dr. Mario and Pokemon Red, which spend most of their non-idle time in
+ * LY/flag polls, DEC/JR countdowns, 16-bit countdowns and copy loops. */
+static int fused_length(const struct uop* u, int n)
+{
+	switch (u->op) {
+		case 0x05: case 0x0D: case 0x15: case 0x1D:	/* DEC r ; JR NZ */
+		case 0x25: case 0x2D: case 0x3D:
+			return n >= 2 && u[1].op == 0x20 ? 2 : 0;
+		case 0x0B:	/* DEC BC ; LD A,B ; OR C ; JR NZ */
+			return n >= 4 && u[1].op == 0x78 && u[2].op == 0xB1 && u[3].op == 0x20 ? 4 : 0;
+		case 0x1B:	/* DEC DE ; LD A,D ; OR E ; JR NZ */
+			return n >= 4 && u[1].op == 0x7A && u[2].op == 0xB3 && u[3].op == 0x20 ? 4 : 0;
+		case 0x2A:	/* LD A,(HL+) ; LD (DE),A ; INC DE */
+			return n >= 3 && u[1].op == 0x12 && u[2].op == 0x13 ? 3 : 0;
+		case 0xF0:	/* LDH A,(n) ; CP n ; JR cc */
+			return n >= 3 && u[1].op == 0xFE && is_jr_cc(u[2].op) ? 3 : 0;
 	}
+	return 0;
 }
+#endif
 
-static void SET(uint8_t bit, uint8_t reg)
+/* Decodes the block starting at pc into the pool and indexes it */
+static const struct uop* block_decode(uint16_t pc, uint16_t bank)
 {
-	uint8_t t;
+	if (blocks.used + BLOCK_MAX_OPS > CPU_BLOCK_CACHE_OPS)
+		cpu_flush_blocks();
 
-	switch(reg)
-	{
-		case 0: /* B */
-			c.B |= bit;
-		break;
-		case 1: /* C */
-			c.C |= bit;
-		break;
-		case 2: /* D */
-			c.D |= bit;
-		break;
-		case 3: /* E */
-			c.E |= bit;
-		break;
-		case 4: /* H */
-			c.H |= bit;
-		break;
-		case 5: /* L */
-			c.L |= bit;
-		break;
-		case 6: /* (HL) */
-			t = mem_get_byte(get_HL());
-			t |= bit;
-			mem_write_byte(get_HL(), t);
-			c.cycles += 2;
-		break;
-		case 7: /* A */
-			c.A |= bit;
-		break;
+	/* Instructions must not straddle the bank 0 / switchable bank edge */
+	const uint16_t end = pc < 0x4000 ? 0x4000 : 0x8000;
+	struct uop* first = &blocks.ops[blocks.used];
+	struct uop* u = first;
+	uint16_t a = pc;
+
+	while (u < first + BLOCK_MAX_OPS) {
+		uint8_t b = fetch_byte(a);
+		uint8_t len = op_length[b];
+		if (a + len > end)
+			break;
+		u->op = b;
+		u->info = len;
+		u->imm = len == 3 ? fetch_word(a + 1) : len == 2 ? fetch_byte(a + 1) : 0;
+		a += len;
+		u++;
+		if (op_ends_block(b))
+			break;
 	}
+	if (u == first)
+		return NULL;
+
+	u[-1].info |= UOP_LAST;
+#if CPU_FUSION
+	for (struct uop* f = first; f < u; f++)
+		if (fused_length(f, u - f))
+			f->info |= UOP_FUSED;
+#endif
+	struct block_entry* e = block_entry_for(pc, bank);
+	e->addr = pc;
+	e->bank = bank;
+	e->first = blocks.used;
+	blocks.used += u - first;
+	blocks.misses++;
+	return first;
 }
 
-/*
-00000xxx = RLC xxx
-00001xxx = RRC xxx
-00010xxx = RL xxx
-00011xxx = RR xxx
-00100xxx = SLA xxx
-00101xxx = SRA xxx
-00110xxx = SWAP xxx
-00111xxx = SRL xxx
-01yyyxxx = BIT yyy, xxx
-10yyyxxx = RES yyy, xxx
-11yyyxxx = SET yyy, xxx
-*/
-static void decode_CB(uint8_t t)
+/* Finds or decodes the block starting at pc, NULL if pc isn't ROM code.
+ * Pages are unmapped during OAM DMA, which keeps fetches on the slow path. */
+static inline const struct uop* block_lookup(uint16_t pc)
 {
-	uint8_t reg, opcode, bit;
-	void (*f[])(uint8_t) = {RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL};
-	void (*f2[])(uint8_t, uint8_t) = {BIT_, RES, SET};
+	if (pc >= 0x8000 || !mem_read_map[pc >> 8])
+		return NULL;
 
-	reg = t&7;
-	opcode = t>>3;
-	if(opcode < 8)
-	{
-		f[opcode](reg);
-		return;
+	uint16_t bank = pc < 0x4000 ? 0 : mem_rom_bank;
+	struct block_entry* e = block_entry_for(pc, bank);
+
+	if (e->first != BLOCK_NONE && e->addr == pc && e->bank == bank) {
+		blocks.hits++;
+		return &blocks.ops[e->first];
 	}
+	return block_decode(pc, bank);
+}
+#else
+static inline void block_unchain(void)
+{
+}
 
-	bit = opcode&7;
-	opcode >>= 3;
-	f2[opcode-1](1<<bit, reg);
-	
-	c.cycles += 2;
+void cpu_flush_blocks(void)
+{
 }
+#endif
 
-void cpu_interrupt(uint16_t vector)
+uint32_t cpu_get_block_hits(void)
 {
-	c.SP -= 2;
-	mem_write_word(c.SP, c.PC);
-	c.PC = vector;
-	c.cycles += 5 + halted;
-	halted = 0;
+#if CPU_BLOCK_CACHE
+	return blocks.hits;
+#else
+	return 0;
+#endif
 }
 
-uint32_t cpu_get_cycles(void)
+uint32_t cpu_get_block_misses(void)
 {
-	return c.cycles;
+#if CPU_BLOCK_CACHE
+	return blocks.misses;
+#else
+	return 0;
+#endif
 }
 
-void cpu_print_debug(void)
+#if CPU_OPCODE_PAIRS
+static uint32_t opcode_pairs[256][256];
+static uint8_t last_opcode;
+
+static inline uint8_t count_pair(uint8_t b)
+{
+	opcode_pairs[last_opcode][b]++;
+	last_opcode = b;
+	return b;
+}
+#else
+#define count_pair(b) (b)
+#endif
+
+/* Executed count of each opcode pair, indexed [first * 256 + second].
+ * NULL unless built with CPU_OPCODE_PAIRS. */
+const uint32_t* cpu_get_opcode_pairs(void)
+{
+#if CPU_OPCODE_PAIRS
+	return &opcode_pairs[0][0];
+#else
+	return NULL;
+#endif
+}
+
+#if CPU_TRACE
+/* Records the instruction at pc before it runs, see trace.h */
+static inline void trace_instruction(uint16_t pc, uint8_t op, uint16_t imm, uint8_t flags)
+{
+	struct trace_record* r = trace_next();
+	r->cycles = c.cycles;
+	r->pc = pc;
+	r->bank = mem_rom_bank;
+	r->sp = c.SP;
+	r->imm = imm;
+	r->hl = c.HL;
+	r->de = c.DE;
+	r->bc = c.BC;
+	r->a = c.A;
+	r->f = get_F();
+	r->op = op;
+	r->flags = flags;
+	r->ie = IE;
+	r->if_ = IF;
+	if (pc == trace_trigger)
+		trace_triggered();
+}
+#endif
+
+#if CPU_FUSION
+/* A fused handler may only run its next instruction when the batch isn't
+ * over, the fetch in between would not have serviced an interrupt and the
+ * block is still current (a bank switch unchains it). Every instruction
+ * still ends on the cycle it would have on its own. */
+static inline bool fused_can_continue(void)
+{
+	return (int32_t)(c.cycles - c.target) < 0 && interrupt_quiet() &&
+		blocks.cur != &no_block;
+}
+
+/* Moves on to the next op of a fused sequence */
+template<class P>
+static inline void fused_step(uint16_t* imm)
+{
+	const struct uop* u = ++blocks.cur;
+#if CPU_PROFILER
+	profiler_instruction(c.cycles, c.cycles, u->op, u->imm, c.PC);
+#endif
+#if CPU_TRACE
+	trace_instruction(c.PC, u->op, u->imm, 0);
+#endif
+	c.PC += u->info & UOP_LEN;
+	*imm = u->imm;
+	if (P::mcycle_timing)
+		c.bus = bus_offset[u->op];
+#if CPU_INSTRUCTION_COUNTER
+	c.instructions++;
+#endif
+}
+
+static inline bool jr_condition(uint8_t b)
+{
+	switch (b) {
+		case 0x20: return flag_Z == 0;
+		case 0x28: return flag_Z == 1;
+		case 0x30: return flag_C == 0;
+	}
+	return flag_C == 1;
+}
+#endif
+
+/* Fetches the next opcode and its immediate. Inside a block this is a
+ * step to the next op. */
+template<class P>
+static inline uint16_t cpu_next_op(uint16_t* imm)
+{
+#if CPU_INSTRUCTION_COUNTER
+	c.instructions++;
+#endif
+
+#if CPU_BLOCK_CACHE
+	const struct uop* u = blocks.cur;
+	if (!(u->info & UOP_LAST)) {
+		u++;
+	} else {
+		u = P::halt_bug && halt_bug ? NULL : block_lookup(c.PC);
+		if (!u) {
+			blocks.cur = &no_block;
+			return count_pair(decode_bus_op<P>(imm));
+		}
+	}
+
+	blocks.cur = u;
+	c.PC += u->info & UOP_LEN;
+	*imm = u->imm;
+	if (P::mcycle_timing)
+		c.bus = bus_offset[u->op];
+#if CPU_FUSION
+	/* Fused sequences dispatch to 0x100 + their first opcode */
+	return u->op | ((u->info & UOP_FUSED) << 2);
+#else
+	return count_pair(u->op);
+#endif
+#else
+	return count_pair(decode_bus_op<P>(imm));
+#endif
+}
+
+/* Services interrupts and fetches the next opcode, once per instruction.
+ * Interrupts are only looked at when interrupt_pending is set (see
+ * interrupt.h). Keep this lean, the threaded core inlines it into every
+ * handler. Loop detection and other diagnostics live in supervisor.cpp,
+ * opcode and hotspot counts in profiler.cpp, the instruction trace in
+ * trace.cpp. */
+template<class P>
+static inline uint16_t cpu_fetch_opcode(uint16_t* imm)
 {
-	printf("%04X: %02X\n", c.PC, mem_get_byte(c.PC));
-	printf("\tAF: %02X%02X, BC: %02X%02X, DE: %02X%02X, HL: %02X%02X SP: %04X, cycles %d\n",
-		c.A, c.F, c.B, c.C, c.D, c.E, c.H, c.L, c.SP, c.cycles);
+#if CPU_PROFILER || CPU_TRACE
+	const uint32_t end = c.cycles;
+	if (interrupt_pending)
+		interrupt_flush();
+	const uint16_t pc = c.PC;
+	const uint16_t b = cpu_next_op<P>(imm);
+#if CPU_PROFILER
+	profiler_instruction(end, c.cycles, b, *imm, pc);
+#endif
+#if CPU_TRACE
+	trace_instruction(pc, b, *imm, c.cycles != end ? TRACE_INTERRUPT : 0);
+#endif
+	return b;
+#else
+	if (interrupt_pending)
+		interrupt_flush();
+	return cpu_next_op<P>(imm);
+#endif
 }
 
-/* TODO: investigate why blargg's instr_timing test is failing */
-uint32_t cpu_cycle(void)
+template<class P>
+uint32_t Core<P>::run(uint32_t cycle_budget)
 {
-	uint8_t b, t;
-	uint16_t s;
+	uint8_t t;
+	uint16_t b, s, imm = 0;
 	uint32_t i;
-	
-	if(halted)
-	{
-		// Check if an interrupt should wake us up
-		if (interrupt_flush()) {
-			halted = 0; // Wake up from halt
-			// Continue with normal execution
-		} else {
-			c.cycles += 1;
-			uint32_t delta = (c.cycles - c.lastcycles);
-			c.lastcycles = c.cycles;
-			return delta;
-		}
-	}
-	
-	interrupt_flush();
 
-	b = mem_get_byte(c.PC);
-	
-	// Add debug logging to detect infinite loops
-	static uint16_t last_pc_values[10] = {0};
-	static uint8_t pc_history_index = 0;
-	static uint32_t instruction_count = 0;
-	static uint32_t last_debug_time = 0;
-	
-	instruction_count++;
-	last_pc_values[pc_history_index] = c.PC;
-	pc_history_index = (pc_history_index + 1) % 10;
-	
-	uint32_t current_time = millis();
-	
-	// More aggressive polling loop detection - check every second
-	if (current_time - last_debug_time > 1000) {
-		// Check if we're stuck in a small loop (within 8 addresses)
-		bool in_small_loop = true;
-		uint16_t min_pc = 0xFFFF, max_pc = 0;
-		for (int i = 0; i < 10; i++) {
-			if (last_pc_values[i] < min_pc) min_pc = last_pc_values[i];
-			if (last_pc_values[i] > max_pc) max_pc = last_pc_values[i];
-		}
-		
-		if (max_pc - min_pc > 8) {
-			in_small_loop = false;
-		}
-		
-		// Debug output removed for performance - LY register now works correctly
-		// and no longer needs forced updates or aggressive debug monitoring
-		
-		last_debug_time = current_time;
-	}
-	
-	// More aggressive loop breaking - every 5 seconds instead of 30
-	static uint32_t loop_break_timer = 0;
-	static uint16_t last_break_pc = 0;
-	
-	// Check if we're stuck in a tight area
-	bool stuck_in_area = true;
-	uint16_t pc_min = 0xFFFF, pc_max = 0;
-	for (int i = 0; i < 10; i++) {
-		if (last_pc_values[i] < pc_min) pc_min = last_pc_values[i];
-		if (last_pc_values[i] > pc_max) pc_max = last_pc_values[i];
-	}
-	
-	if (pc_max - pc_min <= 8) { // Stuck in 8-byte area
-		if (last_break_pc != pc_min) {
-			loop_break_timer = current_time;
-			last_break_pc = pc_min;
-		} else if (current_time - loop_break_timer > 5000) { // 5 seconds
-			// Breaking tight loop (debug output removed for performance)
-			
-			// Force multiple interrupts and register updates
-			interrupt(0x01); // VBlank
-			interrupt(0x02); // LCDC 
-			
-			// Update LCD registers aggressively
-			mem_write_byte(0xFF44, (mem_get_byte(0xFF44) + 10) % 154); // LY
-			mem_write_byte(0xFF41, mem_get_byte(0xFF41) ^ 0x03); // STAT mode
-			mem_write_byte(0xFF0F, mem_get_byte(0xFF0F) | 0x07); // Set multiple IF flags
-			
-			loop_break_timer = current_time;
-		}
-	}
-	
-	// Enhanced debugging for infinite loops - simplified for performance
-	if (c.PC == 0x0038 && b == 0xFF) {
-		static uint32_t rst38_count = 0;
-		rst38_count++;
-		// Only log every 1000th occurrence to avoid flooding
-		if (rst38_count % 1000 == 0) {
-			Serial.printf("WARNING: RST 38 loop detected (%d times), Memory at 0x0038: 0x%02X\n", 
-			              rst38_count, mem_get_byte(0x0038));
-		}
-	}
-	
-	if (halt_bug) {
-		halt_bug = false;
-	} else {
-		++c.PC;
-	}
-	
+	c.target = c.cycles + cycle_budget;
+
+#if CPU_THREADED_DISPATCH
+	static const void* const dispatch[256 + 256*CPU_FUSION] = {
+		&&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07, &&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+		&&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17, &&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+		&&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27, &&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+		&&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37, &&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+		&&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47, &&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+		&&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57, &&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+		&&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67, &&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+		&&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77, &&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+		&&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87, &&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+		&&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97, &&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+		&&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7, &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+		&&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7, &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+		&&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7, &&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+		&&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_0xD3, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7, &&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_0xDB, &&op_0xDC, &&op_0xDD, &&op_0xDE, &&op_0xDF,
+		&&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_0xE3, &&op_0xE4, &&op_0xE5, &&op_0xE6, &&op_0xE7, &&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_0xEB, &&op_0xEC, &&op_0xED, &&op_0xEE, &&op_0xEF,
+		&&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3, &&op_0xF4, &&op_0xF5, &&op_0xF6, &&op_0xF7, &&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB, &&op_0xFC, &&op_0xFD, &&op_0xFE, &&op_0xFF,
+#if CPU_FUSION
+		/* 0x100 + first opcode of a fused sequence */
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_0x05, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_0x0B, &&fused_none, &&fused_0x0D, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_0x15, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_0x1B, &&fused_none, &&fused_0x1D, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_0x25, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_0x2A, &&fused_none, &&fused_none, &&fused_0x2D, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_0x3D, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none,
+		&&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none,
+		&&fused_0xF0, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none, &&fused_none,
+#endif
+	};
+
+#define OPCODE(n)	op_##n:
+#define FUSED(n)	fused_##n:
+#define NEXT		do { \
+		if (P::mcycle_timing) \
+			c.bus = 0; \
+		if ((int32_t)(c.cycles - c.target) >= 0 || halted) \
+			goto next_instruction; \
+		b = cpu_fetch_opcode<P>(&imm); \
+		goto *dispatch[b]; \
+	} while(0)
+#else
+#define OPCODE(n)	case n:
+#define FUSED(n)	case 0x100 | n:
+#define NEXT		break
+#endif
+/* Inside a fused handler's do { } while (0): stops after the current
+ * instruction unless the next one may run straight away */
+#define FUSE_NEXT	if (!fused_can_continue()) break; fused_step<P>(&imm)
+
+next_instruction:
+	if (P::mcycle_timing)
+		c.bus = 0;
+	if ((int32_t)(c.cycles - c.target) >= 0)
+		goto done;
+	if (halted && cpu_halt_idle())
+		goto next_instruction;
+
+	b = cpu_fetch_opcode<P>(&imm);
+
+#if CPU_THREADED_DISPATCH
+	goto *dispatch[b];
+#else
 	switch(b)
+#endif
 	{
-		case 0x00:	/* NOP */
+		OPCODE(0x00)	/* NOP */
 			c.cycles += 1;
-		break;
-		case 0x01:	/* LD BC, imm16 */
-			s = mem_get_word(c.PC);
-			set_BC(s);
-			c.PC += 2;
+		NEXT;
+		OPCODE(0x01)	/* LD BC, imm16 */
+			c.BC = IMM16;
 			c.cycles += 3;
-		break;
-		case 0x02:	/* LD (BC), A */
-			mem_write_byte(get_BC(), c.A);
-			c.cycles += 2;
-		break;
-		case 0x03:	/* INC BC */
-			set_BC(get_BC()+1);
-			c.cycles += 2;
-		break;
-		case 0x04:	/* INC B */
-			set_H((c.B&0xF) == 0xF);
-			c.B++;
-			set_Z(!c.B);
-			set_N(0);
-			c.cycles += 1;
-		break;
-		case 0x05:	/* DEC B */
-			c.B--;
-			set_Z(!c.B);
-			set_N(1);
-			set_H((c.B & 0xF) == 0xF);
-			c.cycles += 1;
-		break;
-		case 0x06:	/* LD B, imm8 */
-			c.B = mem_get_byte(c.PC++);
-			c.cycles += 2;
-		break;
-		case 0x07:	/* RLCA */
-			RLC(7);
+		NEXT;
+		OPCODE(0x02)	/* LD (BC), A */
+			bus_write(c.BC, c.A);
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0x03)	/* INC BC */
+			c.BC++;
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0x04)	/* INC B */
+			t = c.B++;
+			flags_inc(t, c.B);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0x05)	/* DEC B */
+			t = c.B--;
+			flags_dec(t, c.B);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0x06)	/* LD B, imm8 */
+			c.B = IMM8;
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0x07)	/* RLCA */
+			cb_op<P, CB_RLC, 0, 7>();
 			set_Z(0);
 			c.cycles += 1;
-		break;
-		case 0x08:	/* LD (imm16), SP */
-			mem_write_word(mem_get_word(c.PC), c.SP);
-			c.PC += 2;
+		NEXT;
+		OPCODE(0x08)	/* LD (imm16), SP */
+			bus_write16(IMM16, c.SP);
 			c.cycles += 5;
-		break;
-		case 0x09:	/* ADD HL, BC */
-			i = get_HL() + get_BC();
+		NEXT;
+		OPCODE(0x09)	/* ADD HL, BC */
+			i = c.HL + c.BC;
 			set_N(0);
 			set_C(i >= 0x10000);
-			set_H((i&0xFFF) < (get_HL()&0xFFF));
-			set_HL(i&0xFFFF);
-			c.cycles += 2;
-		break;
-		case 0x0A:	/* LD A, (BC) */
-			c.A = mem_get_byte(get_BC());
-			c.cycles += 2;
-		break;
-		case 0x0B:	/* DEC BC */
-			s = get_BC();
-			s--;
-			set_BC(s);
-			c.cycles += 2;
-		break;
-		case 0x0C:	/* INC C */
-			set_H((c.C&0xF) == 0xF);
-			c.C++;
-			set_Z(!c.C);
-			set_N(0);
-			c.cycles += 1;
-		break;
-		case 0x0D:	/* DEC C */
-			set_H((c.C&0xF) == 0);
-			c.C--;
-			set_Z(!c.C);
-			set_N(1);
-			c.cycles += 1;
-		break;
-		case 0x0E:	/* LD C, imm8 */
-			c.C = mem_get_byte(c.PC++);
-			c.cycles += 2;
-		break;
-		case 0x0F:	/* RRCA */
-			RRC(7);
+			set_H((i&0xFFF) < (c.HL&0xFFF));
+			c.HL = i;
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0x0A)	/* LD A, (BC) */
+			c.A = bus_read(c.BC);
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0x0B)	/* DEC BC */
+			c.BC--;
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0x0C)	/* INC C */
+			t = c.C++;
+			flags_inc(t, c.C);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0x0D)	/* DEC C */
+			t = c.C--;
+			flags_dec(t, c.C);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0x0E)	/* LD C, imm8 */
+			c.C = IMM8;
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0x0F)	/* RRCA */
+			cb_op<P, CB_RRC, 0, 7>();
 			set_Z(0);
 			c.cycles += 1;
-		break;
-		case 0x10: /* STOP */
+		NEXT;
+		OPCODE(0x10) /* STOP */
 			// TODO
-			c.PC++;
 			c.cycles += 1;
-		break;
-		case 0x11:	/* LD DE, imm16 */
-			s = mem_get_word(c.PC);
-			set_DE(s);
-			c.PC += 2;
+		NEXT;
+		OPCODE(0x11)	/* LD DE, imm16 */
+			c.DE = IMM16;
 			c.cycles += 3;
-		break;
-		case 0x12:	/* LD (DE), A */
-			mem_write_byte(get_DE(), c.A);
-			c.cycles += 2;
-		break;
-		case 0x13:	/* INC DE */
-			s = get_DE();
-			s++;
-			set_DE(s);
-			c.cycles += 2;
-		break;
-		case 0x14:	/* INC D */
-			set_H((c.D&0xF) == 0xF);
-			c.D++;
-			set_Z(!c.D);
-			set_N(0);
-			c.cycles += 1;
-		break;
-		case 0x15:	/* DEC D */
-			c.D--;
-			set_Z(!c.D);
-			set_N(1);
-			set_H((c.D & 0xF) == 0xF);
-			c.cycles += 1;
-		break;
-		case 0x16:	/* LD D, imm8 */
-			c.D = mem_get_byte(c.PC++);
-			c.cycles += 2;
-		break;
-		case 0x17:	/* RLA */
-			RL(7);
+		NEXT;
+		OPCODE(0x12)	/* LD (DE), A */
+			bus_write(c.DE, c.A);
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0x13)	/* INC DE */
+			c.DE++;
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0x14)	/* INC D */
+			t = c.D++;
+			flags_inc(t, c.D);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0x15)	/* DEC D */
+			t = c.D--;
+			flags_dec(t, c.D);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0x16)	/* LD D, imm8 */
+			c.D = IMM8;
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0x17)	/* RLA */
+			cb_op<P, CB_RL, 0, 7>();
 			set_Z(0);
 			c.cycles += 1;
-		break;
-		case 0x18:	/* JR rel8 */
-			c.PC += (signed char)mem_get_byte(c.PC) + 1;
+		NEXT;
+		OPCODE(0x18)	/* JR rel8 */
+			c.PC += (signed char)IMM8;
 			c.cycles += 3;
-		break;
-		case 0x19:	/* ADD HL, DE */
-			i = get_HL() + get_DE();
-			set_H((i&0xFFF) < (get_HL()&0xFFF));
-			set_HL(i);
+		NEXT;
+		OPCODE(0x19)	/* ADD HL, DE */
+			i = c.HL + c.DE;
+			set_H((i&0xFFF) < (c.HL&0xFFF));
+			c.HL = i;
 			set_N(0);
 			set_C(i > 0xFFFF);
 			c.cycles += 2;
-		break;
-		case 0x1A:	/* LD A, (DE) */
-			c.A = mem_get_byte(get_DE());
+		NEXT;
+		OPCODE(0x1A)	/* LD A, (DE) */
+			c.A = bus_read(c.DE);
 			c.cycles += 2;
-		break;
-		case 0x1B:	/* DEC DE */
-			s = get_DE();
-			s--;
-			set_DE(s);
+		NEXT;
+		OPCODE(0x1B)	/* DEC DE */
+			c.DE--;
 			c.cycles += 2;
-		break;
-		case 0x1C:	/* INC E */
-			set_H((c.E&0xF) == 0xF);
-			c.E++;
-			set_Z(!c.E);
-			set_N(0);
+		NEXT;
+		OPCODE(0x1C)	/* INC E */
+			t = c.E++;
+			flags_inc(t, c.E);
 			c.cycles += 1;
-		break;
-		case 0x1D:	/* DEC E */
-			c.E--;
-			set_Z(!c.E);
-			set_N(1);
-			set_H((c.E & 0xF) == 0xF);
+		NEXT;
+		OPCODE(0x1D)	/* DEC E */
+			t = c.E--;
+			flags_dec(t, c.E);
 			c.cycles += 1;
-		break;
-		case 0x1E:	/* LD E, imm8 */
-			c.E = mem_get_byte(c.PC++);
+		NEXT;
+		OPCODE(0x1E)	/* LD E, imm8 */
+			c.E = IMM8;
 			c.cycles += 2;
-		break;
-		case 0x1F:	/* RR A */
-			RR(7);
+		NEXT;
+		OPCODE(0x1F)	/* RR A */
+			cb_op<P, CB_RR, 0, 7>();
 			set_Z(0);
 			c.cycles += 1;
-		break;
-		case 0x20:	/* JR NZ, rel8 */
+		NEXT;
+		OPCODE(0x20)	/* JR NZ, rel8 */
 			if(flag_Z == 0)
 			{
-				c.PC += (signed char)mem_get_byte(c.PC) + 1;
-				c.cycles += 3;
+				jr_taken(imm);
 			} else {
-				c.PC += 1;
 				c.cycles += 2;
 			}
-		break;
-		case 0x21:	/* LD HL, imm16 */
-			s = mem_get_word(c.PC);
-			set_HL(s);
-			c.PC += 2;
+		NEXT;
+		OPCODE(0x21)	/* LD HL, imm16 */
+			c.HL = IMM16;
 			c.cycles += 3;
-		break;
-		case 0x22:	/* LDI (HL), A */
-			i = get_HL();
-			mem_write_byte(i, c.A);
-			i++;
-			set_HL(i);
-			c.cycles += 2;
-		break;
-		case 0x23:	/* INC HL */
-			s = get_HL();
-			s++;
-			set_HL(s);
-			c.cycles += 2;
-		break;
-		case 0x24:	/* INC H */
-			c.H++;
-			set_Z(!c.H);
-			set_H((c.H&0xF) == 0);
-			set_N(0);
-			c.cycles += 1;
-		break;
-		case 0x25:	/* DEC H */
-			c.H--;
-			set_Z(!c.H);
-			set_N(1);
-			set_H((c.H & 0xF) == 0xF);
-			c.cycles += 1;
-		break;
-		case 0x26:	/* LD H, imm8 */
-			c.H = mem_get_byte(c.PC++);
-			c.cycles += 2;
-		break;
-		case 0x27:	/* DAA */
+		NEXT;
+		OPCODE(0x22)	/* LDI (HL), A */
+			bus_write(c.HL++, c.A);
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0x23)	/* INC HL */
+			c.HL++;
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0x24)	/* INC H */
+			t = c.H++;
+			flags_inc(t, c.H);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0x25)	/* DEC H */
+			t = c.H--;
+			flags_dec(t, c.H);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0x26)	/* LD H, imm8 */
+			c.H = IMM8;
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0x27)	/* DAA */
 			s = c.A;
 
 			if(flag_N)
@@ -1091,1325 +1377,1253 @@ uint32_t cpu_cycle(void)
 			if(s >= 0x100)
 				set_C(1);
 			c.cycles += 1;
-		break;
-		case 0x28:	/* JR Z, rel8 */
+		NEXT;
+		OPCODE(0x28)	/* JR Z, rel8 */
 			if(flag_Z == 1)
 			{
-				c.PC += (signed char)mem_get_byte(c.PC) + 1;
-				c.cycles += 3;
+				jr_taken(imm);
 			} else {
-				c.PC += 1;
 				c.cycles += 2;
 			}
-		break;
-		case 0x29:	/* ADD HL, HL */
-			i = get_HL()*2;
-			set_H((i&0x7FF) < (get_HL()&0x7FF));
+		NEXT;
+		OPCODE(0x29)	/* ADD HL, HL */
+			i = c.HL*2;
+			set_H((i&0xFFF) < (c.HL&0xFFF));
 			set_C(i > 0xFFFF);
-			set_HL(i);
+			c.HL = i;
 			set_N(0);
 			c.cycles += 2;
-		break;
-		case 0x2A:	/* LDI A, (HL) */
-			s = get_HL();
-			c.A = mem_get_byte(s);
-			set_HL(s+1);
+		NEXT;
+		OPCODE(0x2A)	/* LDI A, (HL) */
+			c.A = bus_read(c.HL++);
 			c.cycles += 2;
-		break;
-		case 0x2B: 	/* DEC HL */
-			set_HL(get_HL()-1);
+		NEXT;
+		OPCODE(0x2B) 	/* DEC HL */
+			c.HL--;
 			c.cycles += 2;
-		break;
-		case 0x2C:	/* INC L */
-			c.L++;
-			set_Z(!c.L);
-			set_N(0);
-			set_H((c.L & 0xF) == 0x00);
+		NEXT;
+		OPCODE(0x2C)	/* INC L */
+			t = c.L++;
+			flags_inc(t, c.L);
 			c.cycles += 1;
-		break;
-		case 0x2D:	/* DEC L */
-			c.L--;
-			set_Z(!c.L);
-			set_N(1);
-			set_H((c.L & 0xF) == 0xF);
+		NEXT;
+		OPCODE(0x2D)	/* DEC L */
+			t = c.L--;
+			flags_dec(t, c.L);
 			c.cycles += 1;
-		break;
-		case 0x2E:	/* LD L, imm8 */
-			c.L = mem_get_byte(c.PC++);
+		NEXT;
+		OPCODE(0x2E)	/* LD L, imm8 */
+			c.L = IMM8;
 			c.cycles += 2;
-		break;
-		case 0x2F:	/* CPL */
+		NEXT;
+		OPCODE(0x2F)	/* CPL */
 			c.A = ~c.A;
 			set_N(1);
 			set_H(1);
 			c.cycles += 1;
-		break;
-		case 0x30:	/* JR NC, rel8 */
+		NEXT;
+		OPCODE(0x30)	/* JR NC, rel8 */
 			if(flag_C == 0)
 			{
-				c.PC += (signed char)mem_get_byte(c.PC) + 1;
-				c.cycles += 3;
+				jr_taken(imm);
 			} else {
-				c.PC += 1;
 				c.cycles += 2;
 			}
-		break;
-		case 0x31:	/* LD SP, imm16 */
-			c.SP = mem_get_word(c.PC);
-			c.PC += 2;
+		NEXT;
+		OPCODE(0x31)	/* LD SP, imm16 */
+			c.SP = IMM16;
 			c.cycles += 3;
-		break;
-		case 0x32:	/* LDD (HL), A */
-			i = get_HL();
-			mem_write_byte(i, c.A);
-			set_HL(i-1);
+		NEXT;
+		OPCODE(0x32)	/* LDD (HL), A */
+			bus_write(c.HL--, c.A);
 			c.cycles += 2;
-		break;
-		case 0x33:	/* INC SP */
+		NEXT;
+		OPCODE(0x33)	/* INC SP */
 			c.SP++;
 			c.cycles += 2;
-		break;
-		case 0x34:	/* INC (HL) */
-			t = mem_get_byte(get_HL());
-			t++;
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-			set_N(0);
-			set_H((t & 0xF) == 0);
+		NEXT;
+		OPCODE(0x34)	/* INC (HL) */
+			s = bus_read(c.HL);
+			t = s + 1;
+			bus_write(c.HL, t);
+			flags_inc(s, t);
 			c.cycles += 3;
-		break;
-		case 0x35:	/* DEC (HL) */
-			t = mem_get_byte(get_HL());
-			t--;
-			mem_write_byte(get_HL(), t);
-			set_Z(!t);
-			set_N(1);
-			set_H((t & 0xF) == 0xF);
+		NEXT;
+		OPCODE(0x35)	/* DEC (HL) */
+			s = bus_read(c.HL);
+			t = s - 1;
+			bus_write(c.HL, t);
+			flags_dec(s, t);
 			c.cycles += 3;
-		break;
-		case 0x36:	/* LD (HL), imm8 */
-			t = mem_get_byte(c.PC++);
-			mem_write_byte(get_HL(), t);
+		NEXT;
+		OPCODE(0x36)	/* LD (HL), imm8 */
+			t = IMM8;
+			bus_write(c.HL, t);
 			c.cycles += 3;
-		break;
-		case 0x37:	/* SCF */
+		NEXT;
+		OPCODE(0x37)	/* SCF */
 			set_N(0);
 			set_H(0);
 			set_C(1);
 			c.cycles += 1;
-		break;
-		case 0x38:  /* JR C, rel8 */
+		NEXT;
+		OPCODE(0x38)  /* JR C, rel8 */
 			if(flag_C == 1)
 			{
-				c.PC += (signed char)mem_get_byte(c.PC) + 1;
-				c.cycles += 3;
+				jr_taken(imm);
 			} else {
-				c.PC += 1;
 				c.cycles += 2;
 			}
-		break;
-		case 0x39:	/* ADD HL, SP */
-			i = get_HL() + c.SP;
-			set_H((i&0x7FF) < (get_HL()&0x7FF));
+		NEXT;
+		OPCODE(0x39)	/* ADD HL, SP */
+			i = c.HL + c.SP;
+			set_H((i&0xFFF) < (c.HL&0xFFF));
 			set_C(i > 0xFFFF);
 			set_N(0);
-			set_HL(i);
+			c.HL = i;
 			c.cycles += 2;
-		break;
-		case 0x3A:	/* LDD A, (HL) */
-			c.A = mem_get_byte(get_HL());
-			set_HL(get_HL()-1);
+		NEXT;
+		OPCODE(0x3A)	/* LDD A, (HL) */
+			c.A = bus_read(c.HL--);
 			c.cycles += 2;
-		break;
-		case 0x3B:	/* DEC SP */
+		NEXT;
+		OPCODE(0x3B)	/* DEC SP */
 			c.SP--;
 			c.cycles += 2;
-		break;
-		case 0x3C:	/* INC A */
-			c.A++;
-			set_Z(!c.A);
-			set_H((c.A&0xF) == 0);
-			set_N(0);
+		NEXT;
+		OPCODE(0x3C)	/* INC A */
+			t = c.A++;
+			flags_inc(t, c.A);
 			c.cycles += 1;
-		break;
-		case 0x3D:	/* DEC A */
-			c.A--;
-			set_Z(!c.A);
-			set_N(1);
-			set_H((c.A & 0xF) == 0xF);
+		NEXT;
+		OPCODE(0x3D)	/* DEC A */
+			t = c.A--;
+			flags_dec(t, c.A);
 			c.cycles += 1;
-		break;
-		case 0x3E:	/* LD A, imm8 */
-			c.A = mem_get_byte(c.PC++);
+		NEXT;
+		OPCODE(0x3E)	/* LD A, imm8 */
+			c.A = IMM8;
 			c.cycles += 2;
-		break;
-		case 0x3F:	/* CCF */
+		NEXT;
+		OPCODE(0x3F)	/* CCF */
 			set_N(0);
 			set_H(0);
 			set_C(!flag_C);
 			c.cycles += 1;
-		break;
-		case 0x40:	/* LD B, B */
+		NEXT;
+		OPCODE(0x40)	/* LD B, B */
 			c.B = c.B;
 			c.cycles += 1;
-		break;
-		case 0x41:	/* LD B, C */
+		NEXT;
+		OPCODE(0x41)	/* LD B, C */
 			c.B = c.C;
 			c.cycles += 1;
-		break;
-		case 0x42:	/* LD B, D */
+		NEXT;
+		OPCODE(0x42)	/* LD B, D */
 			c.B = c.D;
 			c.cycles += 1;
-		break;
-		case 0x43:	/* LD B, E */
+		NEXT;
+		OPCODE(0x43)	/* LD B, E */
 			c.B = c.E;
 			c.cycles += 1;
-		break;
-		case 0x44:	/* LD B, H */
+		NEXT;
+		OPCODE(0x44)	/* LD B, H */
 			c.B = c.H;
 			c.cycles += 1;
-		break;
-		case 0x45:	/* LD B, L */
+		NEXT;
+		OPCODE(0x45)	/* LD B, L */
 			c.B = c.L;
 			c.cycles += 1;
-		break;
-		case 0x46:	/* LD B, (HL) */
-			c.B = mem_get_byte(get_HL());
+		NEXT;
+		OPCODE(0x46)	/* LD B, (HL) */
+			c.B = bus_read(c.HL);
 			c.cycles += 2;
-		break;
-		case 0x47:	/* LD B, A */
+		NEXT;
+		OPCODE(0x47)	/* LD B, A */
 			c.B = c.A;
 			c.cycles += 1;
-		break;
-		case 0x48:	/* LD C, B */
+		NEXT;
+		OPCODE(0x48)	/* LD C, B */
 			c.C = c.B;
 			c.cycles += 1;
-		break;
-		case 0x49:	/* LD C, C */
+		NEXT;
+		OPCODE(0x49)	/* LD C, C */
 			c.C = c.C;
 			c.cycles += 1;
-		break;
-		case 0x4A:	/* LD C, D */
+		NEXT;
+		OPCODE(0x4A)	/* LD C, D */
 			c.C = c.D;
 			c.cycles += 1;
-		break;
-		case 0x4B:	/* LD C, E */
+		NEXT;
+		OPCODE(0x4B)	/* LD C, E */
 			c.C = c.E;
 			c.cycles += 1;
-		break;
-		case 0x4C:	/* LD C, H */
+		NEXT;
+		OPCODE(0x4C)	/* LD C, H */
 			c.C = c.H;
 			c.cycles += 1;
-		break;
-		case 0x4D:	/* LD C, L */
+		NEXT;
+		OPCODE(0x4D)	/* LD C, L */
 			c.C = c.L;
 			c.cycles += 1;
-		break;
-		case 0x4E:	/* LD C, (HL) */
-			c.C = mem_get_byte(get_HL());
+		NEXT;
+		OPCODE(0x4E)	/* LD C, (HL) */
+			c.C = bus_read(c.HL);
 			c.cycles += 2;
-		break;
-		case 0x4F:	/* LD C, A */
+		NEXT;
+		OPCODE(0x4F)	/* LD C, A */
 			c.C = c.A;
 			c.cycles += 1;
-		break;
-		case 0x50:	/* LD D, B */
+		NEXT;
+		OPCODE(0x50)	/* LD D, B */
 			c.D = c.B;
 			c.cycles += 1;
-		break;
-		case 0x51:	/* LD D, C */
+		NEXT;
+		OPCODE(0x51)	/* LD D, C */
 			c.D = c.C;
 			c.cycles += 1;
-		break;
-		case 0x52:	/* LD D, D */
+		NEXT;
+		OPCODE(0x52)	/* LD D, D */
 			c.D = c.D;
 			c.cycles += 1;
-		break;
-		case 0x53:	/* LD D, E */
+		NEXT;
+		OPCODE(0x53)	/* LD D, E */
 			c.D = c.E;
 			c.cycles += 1;
-		break;
-		case 0x54:	/* LD D, H */
+		NEXT;
+		OPCODE(0x54)	/* LD D, H */
 			c.D = c.H;
 			c.cycles += 1;
-		break;
-		case 0x55:	/* LD D, L */
+		NEXT;
+		OPCODE(0x55)	/* LD D, L */
 			c.D = c.L;
 			c.cycles += 1;
-		break;
-		case 0x56:	/* LD D, (HL) */
-			c.D = mem_get_byte(get_HL());
+		NEXT;
+		OPCODE(0x56)	/* LD D, (HL) */
+			c.D = bus_read(c.HL);
 			c.cycles += 2;
-		break;
-		case 0x57:	/* LD D, A */
+		NEXT;
+		OPCODE(0x57)	/* LD D, A */
 			c.D = c.A;
 			c.cycles += 1;
-		break;
-		case 0x58:	/* LD E, B */
+		NEXT;
+		OPCODE(0x58)	/* LD E, B */
 			c.E = c.B;
 			c.cycles += 1;
-		break;
-		case 0x59:	/* LD E, C */
+		NEXT;
+		OPCODE(0x59)	/* LD E, C */
 			c.E = c.C;
 			c.cycles += 1;
-		break;
-		case 0x5A:	/* LD E, D */
+		NEXT;
+		OPCODE(0x5A)	/* LD E, D */
 			c.E = c.D;
 			c.cycles += 1;
-		break;
-		case 0x5B:	/* LD E, E */
+		NEXT;
+		OPCODE(0x5B)	/* LD E, E */
 			c.E = c.E;
 			c.cycles += 1;
-		break;
-		case 0x5C:	/* LD E, H */
+		NEXT;
+		OPCODE(0x5C)	/* LD E, H */
 			c.E = c.H;
 			c.cycles += 1;
-		break;
-		case 0x5D:	/* LD E, L */
+		NEXT;
+		OPCODE(0x5D)	/* LD E, L */
 			c.E = c.L;
 			c.cycles += 1;
-		break;
-		case 0x5E:	/* LD E, (HL) */
-			c.E = mem_get_byte(get_HL());
+		NEXT;
+		OPCODE(0x5E)	/* LD E, (HL) */
+			c.E = bus_read(c.HL);
 			c.cycles += 2;
-		break;
-		case 0x5F:	/* LD E, A */
+		NEXT;
+		OPCODE(0x5F)	/* LD E, A */
 			c.E = c.A;
 			c.cycles += 1;
-		break;
-		case 0x60:	/* LD H, B */
+		NEXT;
+		OPCODE(0x60)	/* LD H, B */
 			c.H = c.B;
 			c.cycles += 1;
-		break;
-		case 0x61:	/* LD H, C */
+		NEXT;
+		OPCODE(0x61)	/* LD H, C */
 			c.H = c.C;
 			c.cycles += 1;
-		break;
-		case 0x62:	/* LD H, D */
+		NEXT;
+		OPCODE(0x62)	/* LD H, D */
 			c.H = c.D;
 			c.cycles += 1;
-		break;
-		case 0x63:	/* LD H, E */
+		NEXT;
+		OPCODE(0x63)	/* LD H, E */
 			c.H = c.E;
 			c.cycles += 1;
-		break;
-		case 0x64:	/* LD H, H */
+		NEXT;
+		OPCODE(0x64)	/* LD H, H */
 			c.H = c.H;
 			c.cycles += 1;
-		break;
-		case 0x65:	/* LD H, L */
+		NEXT;
+		OPCODE(0x65)	/* LD H, L */
 			c.H = c.L;
 			c.cycles += 1;
-		break;
-		case 0x66:	/* LD H, (HL) */
-			c.H = mem_get_byte(get_HL());
+		NEXT;
+		OPCODE(0x66)	/* LD H, (HL) */
+			c.H = bus_read(c.HL);
 			c.cycles += 2;
-		break;
-		case 0x67:	/* LD H, A */
+		NEXT;
+		OPCODE(0x67)	/* LD H, A */
 			c.H = c.A;
 			c.cycles += 1;
-		break;
-		case 0x68:	/* LD L, B */
+		NEXT;
+		OPCODE(0x68)	/* LD L, B */
 			c.L = c.B;
 			c.cycles += 1;
-		break;
-		case 0x69:	/* LD L, C */
+		NEXT;
+		OPCODE(0x69)	/* LD L, C */
 			c.L = c.C;
 			c.cycles += 1;
-		break;
-		case 0x6A:	/* LD L, D */
+		NEXT;
+		OPCODE(0x6A)	/* LD L, D */
 			c.L = c.D;
 			c.cycles += 1;
-		break;
-		case 0x6B:	/* LD L, E */
+		NEXT;
+		OPCODE(0x6B)	/* LD L, E */
 			c.L = c.E;
 			c.cycles += 1;
-		break;
-		case 0x6C:	/* LD L, H */
+		NEXT;
+		OPCODE(0x6C)	/* LD L, H */
 			c.L = c.H;
 			c.cycles += 1;
-		break;
-		case 0x6D:	/* LD L, L */
+		NEXT;
+		OPCODE(0x6D)	/* LD L, L */
 			c.L = c.L;
 			c.cycles += 1;
-		break;
-		case 0x6E:	/* LD L, (HL) */
-			c.L = mem_get_byte(get_HL());
+		NEXT;
+		OPCODE(0x6E)	/* LD L, (HL) */
+			c.L = bus_read(c.HL);
 			c.cycles += 2;
-		break;
-		case 0x6F:	/* LD L, A */
+		NEXT;
+		OPCODE(0x6F)	/* LD L, A */
 			c.L = c.A;
 			c.cycles += 1;
-		break;
-		case 0x70:	/* LD (HL), B */
-			mem_write_byte(get_HL(), c.B);
+		NEXT;
+		OPCODE(0x70)	/* LD (HL), B */
+			bus_write(c.HL, c.B);
 			c.cycles += 2;
-		break;
-		case 0x71:	/* LD (HL), C */
-			mem_write_byte(get_HL(), c.C);
+		NEXT;
+		OPCODE(0x71)	/* LD (HL), C */
+			bus_write(c.HL, c.C);
 			c.cycles += 2;
-		break;
-		case 0x72:	/* LD (HL), D */
-			mem_write_byte(get_HL(), c.D);
+		NEXT;
+		OPCODE(0x72)	/* LD (HL), D */
+			bus_write(c.HL, c.D);
 			c.cycles += 2;
-		break;
-		case 0x73:	/* LD (HL), E */
-			mem_write_byte(get_HL(), c.E);
+		NEXT;
+		OPCODE(0x73)	/* LD (HL), E */
+			bus_write(c.HL, c.E);
 			c.cycles += 2;
-		break;
-		case 0x74:	/* LD (HL), H */
-			mem_write_byte(get_HL(), c.H);
+		NEXT;
+		OPCODE(0x74)	/* LD (HL), H */
+			bus_write(c.HL, c.H);
 			c.cycles += 2;
-		break;
-		case 0x75:	/* LD (HL), L */
-			mem_write_byte(get_HL(), c.L);
+		NEXT;
+		OPCODE(0x75)	/* LD (HL), L */
+			bus_write(c.HL, c.L);
 			c.cycles += 2;
-		break;
-		case 0x76: {	/* HALT */
+		NEXT;
+		OPCODE(0x76) {	/* HALT */
 			if (!IME && (IF & IE & 0x1F)) {
-				halt_bug = true;
+				/* Doesn't halt, and with the bug the next opcode
+				 * is read twice */
+				if (P::halt_bug)
+					halt_bug = true;
 			} else {
 				halted = 1;
 			}
 			c.cycles += 1;
 		}
-		break;
-		case 0x77:	/* LD (HL), A */
-			mem_write_byte(get_HL(), c.A);
+		NEXT;
+		OPCODE(0x77)	/* LD (HL), A */
+			bus_write(c.HL, c.A);
 			c.cycles += 2;
-		break;
-		case 0x78:	/* LD A, B */
+		NEXT;
+		OPCODE(0x78)	/* LD A, B */
 			c.A = c.B;
 			c.cycles += 1;
-		break;
-		case 0x79:	/* LD A, C */
+		NEXT;
+		OPCODE(0x79)	/* LD A, C */
 			c.A = c.C;
 			c.cycles += 1;
-		break;
-		case 0x7A:	/* LD A, D */
+		NEXT;
+		OPCODE(0x7A)	/* LD A, D */
 			c.A = c.D;
 			c.cycles += 1;
-		break;
-		case 0x7B:	/* LD A, E */
+		NEXT;
+		OPCODE(0x7B)	/* LD A, E */
 			c.A = c.E;
 			c.cycles += 1;
-		break;
-		case 0x7C:	/* LD A, H */
+		NEXT;
+		OPCODE(0x7C)	/* LD A, H */
 			c.A = c.H;
 			c.cycles += 1;
-		break;
-		case 0x7D:	/* LD A, L */
+		NEXT;
+		OPCODE(0x7D)	/* LD A, L */
 			c.A = c.L;
 			c.cycles += 1;
-		break;
-		case 0x7E:	/* LD A, (HL) */
-			c.A = mem_get_byte(get_HL());
+		NEXT;
+		OPCODE(0x7E)	/* LD A, (HL) */
+			c.A = bus_read(c.HL);
 			c.cycles += 2;
-		break;
-		case 0x7F:	/* LD A, A */
+		NEXT;
+		OPCODE(0x7F)	/* LD A, A */
 			c.A = c.A;
 			c.cycles += 1;
-		break;
-		case 0x80:	/* ADD B */
+		NEXT;
+		OPCODE(0x80)	/* ADD B */
 			i = c.A + c.B;
-			set_H((c.A&0xF)+(c.B&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
+			flags_add(c.A, c.B, i);
 			c.A = i;
-			set_Z(!c.A);
 			c.cycles += 1;
-		break;
-		case 0x81:	/* ADD C */
+		NEXT;
+		OPCODE(0x81)	/* ADD C */
 			i = c.A + c.C;
-			set_H((c.A&0xF)+(c.C&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
+			flags_add(c.A, c.C, i);
 			c.A = i;
-			set_Z(!c.A);
 			c.cycles += 1;
-		break;
-		case 0x82:	/* ADD D */
+		NEXT;
+		OPCODE(0x82)	/* ADD D */
 			i = c.A + c.D;
-			set_H((c.A&0xF)+(c.D&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
+			flags_add(c.A, c.D, i);
 			c.A = i;
-			set_Z(!c.A);
 			c.cycles += 1;
-		break;
-		case 0x83:	/* ADD E */
+		NEXT;
+		OPCODE(0x83)	/* ADD E */
 			i = c.A + c.E;
-			set_H((c.A&0xF)+(c.E&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
+			flags_add(c.A, c.E, i);
 			c.A = i;
-			set_Z(!c.A);
 			c.cycles += 1;
-		break;
-		case 0x84:	/* ADD H */
+		NEXT;
+		OPCODE(0x84)	/* ADD H */
 			i = c.A + c.H;
-			set_H((c.A&0xF)+(c.H&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
+			flags_add(c.A, c.H, i);
 			c.A = i;
-			set_Z(!c.A);
 			c.cycles += 1;
-		break;
-		case 0x85:	/* ADD L */
+		NEXT;
+		OPCODE(0x85)	/* ADD L */
 			i = c.A + c.L;
-			set_H((c.A&0xF)+(c.L&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
+			flags_add(c.A, c.L, i);
 			c.A = i;
-			set_Z(!c.A);
 			c.cycles += 1;
-		break;
-		case 0x86:	/* ADD (HL) */
-			i = c.A + mem_get_byte(get_HL());
-			set_H((i&0xF) < (c.A&0xF));
-			set_C(i > 0xFF);
-			set_N(0);
+		NEXT;
+		OPCODE(0x86)	/* ADD (HL) */
+			t = bus_read(c.HL);
+			i = c.A + t;
+			flags_add(c.A, t, i);
 			c.A = i;
-			set_Z(!c.A);
 			c.cycles += 2;
-		break;
-		case 0x87:	/* ADD A */
+		NEXT;
+		OPCODE(0x87)	/* ADD A */
 			i = c.A + c.A;
-			set_H((c.A&0xF)+(c.A&0xF) > 0xF);
-			set_C(i > 0xFF);
-			set_N(0);
+			flags_add(c.A, c.A, i);
 			c.A = i;
-			set_Z(!c.A);
-			c.cycles += 1;
-		break;
-		case 0x88:	/* ADC B */
-			i = c.A + c.B + flag_C >= 0x100;
-			set_N(0);
-			set_H(((c.A&0xF) + (c.B&0xF) + flag_C) >= 0x10);
-			c.A = c.A + c.B + flag_C;
-			set_C(i);
-			set_Z(!c.A);
 			c.cycles += 1;
-		break;
-		case 0x89:	/* ADC C */
-			i = c.A + c.C + flag_C >= 0x100;
-			set_N(0);
-			set_H(((c.A&0xF) + (c.C&0xF) + flag_C) >= 0x10);
-			c.A = c.A + c.C + flag_C;
-			set_C(i);
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x88)	/* ADC B */
+			i = c.A + c.B + flag_C;
+			flags_add(c.A, c.B, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x8A:	/* ADC D */
-			i = c.A + c.D + flag_C >= 0x100;
-			set_N(0);
-			set_H(((c.A&0xF) + (c.D&0xF) + flag_C) >= 0x10);
-			c.A = c.A + c.D + flag_C;
-			set_C(i);
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x89)	/* ADC C */
+			i = c.A + c.C + flag_C;
+			flags_add(c.A, c.C, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x8B:	/* ADC E */
-			i = c.A + c.E + flag_C >= 0x100;
-			set_N(0);
-			set_H(((c.A&0xF) + (c.E&0xF) + flag_C) >= 0x10);
-			c.A = c.A + c.E + flag_C;
-			set_C(i);
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x8A)	/* ADC D */
+			i = c.A + c.D + flag_C;
+			flags_add(c.A, c.D, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x8C:	/* ADC H */
-			i = c.A + c.H + flag_C >= 0x100;
-			set_N(0);
-			set_H(((c.A&0xF) + (c.H&0xF) + flag_C) >= 0x10);
-			c.A = c.A + c.H + flag_C;
-			set_C(i);
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x8B)	/* ADC E */
+			i = c.A + c.E + flag_C;
+			flags_add(c.A, c.E, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x8D:	/* ADC L */
-			i = c.A + c.L + flag_C >= 0x100;
-			set_N(0);
-			set_H(((c.A&0xF) + (c.L&0xF) + flag_C) >= 0x10);
-			c.A = c.A + c.L + flag_C;
-			set_C(i);
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x8C)	/* ADC H */
+			i = c.A + c.H + flag_C;
+			flags_add(c.A, c.H, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x8E:	/* ADC (HL) */
-			t = mem_get_byte(get_HL());
-			i = c.A + t + flag_C >= 0x100;
-			set_N(0);
-			set_H(((c.A&0xF) + (t&0xF) + flag_C) >= 0x10);
-			c.A = c.A + t + flag_C;
-			set_C(i);
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x8D)	/* ADC L */
+			i = c.A + c.L + flag_C;
+			flags_add(c.A, c.L, i);
+			c.A = i;
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0x8E)	/* ADC (HL) */
+			t = bus_read(c.HL);
+			i = c.A + t + flag_C;
+			flags_add(c.A, t, i);
+			c.A = i;
 			c.cycles += 2;
-		break;
-		case 0x8F:	/* ADC A */
-			i = c.A + c.A + flag_C >= 0x100;
-			set_N(0);
-			set_H(((c.A&0xF) + (c.A&0xF) + flag_C) >= 0x10);
-			c.A = c.A + c.A + flag_C;
-			set_C(i);
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x8F)	/* ADC A */
+			i = c.A + c.A + flag_C;
+			flags_add(c.A, c.A, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x90:	/* SUB B */
-			set_C((c.A - c.B) < 0);
-			set_H(((c.A - c.B)&0xF) > (c.A&0xF));
-			c.A -= c.B;
-			set_Z(!c.A);
-			set_N(1);
+		NEXT;
+		OPCODE(0x90)	/* SUB B */
+			i = c.A - c.B;
+			flags_sub(c.A, c.B, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x91:	/* SUB C */
-			set_C((c.A - c.C) < 0);
-			set_H(((c.A - c.C)&0xF) > (c.A&0xF));
-			c.A -= c.C;
-			set_Z(!c.A);
-			set_N(1);
+		NEXT;
+		OPCODE(0x91)	/* SUB C */
+			i = c.A - c.C;
+			flags_sub(c.A, c.C, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x92:	/* SUB D */
-			set_C((c.A - c.D) < 0);
-			set_H(((c.A - c.D)&0xF) > (c.A&0xF));
-			c.A -= c.D;
-			set_Z(!c.A);
-			set_N(1);
+		NEXT;
+		OPCODE(0x92)	/* SUB D */
+			i = c.A - c.D;
+			flags_sub(c.A, c.D, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x93:	/* SUB E */
-			set_C((c.A - c.E) < 0);
-			set_H(((c.A - c.E)&0xF) > (c.A&0xF));
-			c.A -= c.E;
-			set_Z(!c.A);
-			set_N(1);
+		NEXT;
+		OPCODE(0x93)	/* SUB E */
+			i = c.A - c.E;
+			flags_sub(c.A, c.E, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x94:	/* SUB H */
-			set_C((c.A - c.H) < 0);
-			set_H(((c.A - c.H)&0xF) > (c.A&0xF));
-			c.A -= c.H;
-			set_Z(!c.A);
-			set_N(1);
+		NEXT;
+		OPCODE(0x94)	/* SUB H */
+			i = c.A - c.H;
+			flags_sub(c.A, c.H, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x95:	/* SUB L */
-			set_C((c.A - c.L) < 0);
-			set_H(((c.A - c.L)&0xF) > (c.A&0xF));
-			c.A -= c.L;
-			set_Z(!c.A);
-			set_N(1);
+		NEXT;
+		OPCODE(0x95)	/* SUB L */
+			i = c.A - c.L;
+			flags_sub(c.A, c.L, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x96:	/* SUB (HL) */
-			t = mem_get_byte(get_HL());
-			set_C((c.A - t) < 0);
-			set_H(((c.A - t)&0xF) > (c.A&0xF));
-			c.A -= t;
-			set_Z(!c.A);
-			set_N(1);
+		NEXT;
+		OPCODE(0x96)	/* SUB (HL) */
+			t = bus_read(c.HL);
+			i = c.A - t;
+			flags_sub(c.A, t, i);
+			c.A = i;
 			c.cycles += 2;
-		break;
-		case 0x97:	/* SUB A */
-			set_C(0);
-			set_H(0);
-			c.A = 0;
-			set_Z(1);
-			set_N(1);
+		NEXT;
+		OPCODE(0x97)	/* SUB A */
+			i = c.A - c.A;
+			flags_sub(c.A, c.A, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x98:	/* SBC B */
-			t = flag_C + c.B;
-			set_H(((c.A&0xF) - (c.B&0xF) - flag_C) < 0);
-			set_C((c.A - c.B - flag_C) < 0);
-			set_N(1);
-			c.A -= t;
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x98)	/* SBC B */
+			i = c.A - c.B - flag_C;
+			flags_sub(c.A, c.B, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x99:	/* SBC C */
-			t = flag_C + c.C;
-			set_H(((c.A&0xF) - (c.C&0xF) - flag_C) < 0);
-			set_C((c.A - c.C - flag_C) < 0);
-			set_N(1);
-			c.A -= t;
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x99)	/* SBC C */
+			i = c.A - c.C - flag_C;
+			flags_sub(c.A, c.C, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x9A:	/* SBC D */
-			t = flag_C + c.D;
-			set_H(((c.A&0xF) - (c.D&0xF) - flag_C) < 0);
-			set_C((c.A - c.D - flag_C) < 0);
-			set_N(1);
-			c.A -= t;
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x9A)	/* SBC D */
+			i = c.A - c.D - flag_C;
+			flags_sub(c.A, c.D, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x9B:	/* SBC E */
-			t = flag_C + c.E;
-			set_H(((c.A&0xF) - (c.E&0xF) - flag_C) < 0);
-			set_C((c.A - c.E - flag_C) < 0);
-			set_N(1);
-			c.A -= t;
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x9B)	/* SBC E */
+			i = c.A - c.E - flag_C;
+			flags_sub(c.A, c.E, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x9C:	/* SBC H */
-			t = flag_C + c.H;
-			set_H(((c.A&0xF) - (c.H&0xF) - flag_C) < 0);
-		 set_C((c.A - c.H - flag_C) < 0);
-			set_N(1);
-			c.A -= t;
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x9C)	/* SBC H */
+			i = c.A - c.H - flag_C;
+			flags_sub(c.A, c.H, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x9D:	/* SBC L */
-			t = flag_C + c.L;
-			set_H(((c.A&0xF) - (c.L&0xF) - flag_C) < 0);
-			set_C((c.A - c.L - flag_C) < 0);
-			set_N(1);
-			c.A -= t;
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x9D)	/* SBC L */
+			i = c.A - c.L - flag_C;
+			flags_sub(c.A, c.L, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0x9E:	/* SBC (HL) */
-			t = mem_get_byte(get_HL());
-			b = flag_C + t;
-			set_H(((c.A&0xF) - (t&0xF) - flag_C) < 0);
-			set_C((c.A - t - flag_C) < 0);
-			set_N(1);
-			c.A -= b;
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x9E)	/* SBC (HL) */
+			t = bus_read(c.HL);
+			i = c.A - t - flag_C;
+			flags_sub(c.A, t, i);
+			c.A = i;
 			c.cycles += 2;
-		break;
-		case 0x9F:	/* SBC A */
-			t = flag_C + c.A;
-			set_H(((c.A&0xF) - (c.A&0xF) - flag_C) < 0);
-			set_C((c.A - c.A - flag_C) < 0);
-			set_N(1);
-			c.A -= t;
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0x9F)	/* SBC A */
+			i = c.A - c.A - flag_C;
+			flags_sub(c.A, c.A, i);
+			c.A = i;
 			c.cycles += 1;
-		break;
-		case 0xA0:	/* AND B */
+		NEXT;
+		OPCODE(0xA0)	/* AND B */
 			c.A &= c.B;
-			set_Z(!c.A);
-			set_H(1);
-			set_N(0);
-			set_C(0);
+			flags_and(c.A);
 			c.cycles += 1;
-		break;
-		case 0xA1:	/* AND C */
+		NEXT;
+		OPCODE(0xA1)	/* AND C */
 			c.A &= c.C;
-			set_Z(!c.A);
-			set_H(1);
-			set_N(0);
-			set_C(0);
+			flags_and(c.A);
 			c.cycles += 1;
-		break;
-		case 0xA2:	/* AND D */
+		NEXT;
+		OPCODE(0xA2)	/* AND D */
 			c.A &= c.D;
-			set_Z(!c.A);
-			set_H(1);
-			set_N(0);
-			set_C(0);
+			flags_and(c.A);
 			c.cycles += 1;
-		break;
-		case 0xA3:	/* AND E */
+		NEXT;
+		OPCODE(0xA3)	/* AND E */
 			c.A &= c.E;
-			set_Z(!c.A);
-			set_H(1);
-			set_N(0);
-			set_C(0);
+			flags_and(c.A);
 			c.cycles += 1;
-		break;
-		case 0xA4:	/* AND H */
+		NEXT;
+		OPCODE(0xA4)	/* AND H */
 			c.A &= c.H;
-			set_Z(!c.A);
-			set_H(1);
-			set_N(0);
-			set_C(0);
+			flags_and(c.A);
 			c.cycles += 1;
-		break;
-		case 0xA5:	/* AND L */
+		NEXT;
+		OPCODE(0xA5)	/* AND L */
 			c.A &= c.L;
-			set_Z(!c.A);
-			set_H(1);
-			set_N(0);
-			set_C(0);
+			flags_and(c.A);
 			c.cycles += 1;
-		break;
-		case 0xA6:	/* AND (HL) */
-			c.A &= mem_get_byte(get_HL());
-			set_Z(!c.A);
-			set_H(1);
-			set_N(0);
-			set_C(0);
+		NEXT;
+		OPCODE(0xA6)	/* AND (HL) */
+			t = bus_read(c.HL);
+			c.A &= t;
+			flags_and(c.A);
 			c.cycles += 2;
-		break;
-		case 0xA7:	/* AND A */
-			set_H(1);
-			set_N(0);
-			set_C(0);
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0xA7)	/* AND A */
+			flags_and(c.A);
 			c.cycles += 1;
-		break;
-		case 0xA8:	/* XOR B */
+		NEXT;
+		OPCODE(0xA8)	/* XOR B */
 			c.A ^= c.B;
-			c.F = (!c.A)<<7;
+			flags_or(c.A);
 			c.cycles += 1;
-		break;
-		case 0xA9:	/* XOR C */
+		NEXT;
+		OPCODE(0xA9)	/* XOR C */
 			c.A ^= c.C;
-			c.F = (!c.A)<<7;
+			flags_or(c.A);
 			c.cycles += 1;
-		break;
-		case 0xAA:	/* XOR D */
+		NEXT;
+		OPCODE(0xAA)	/* XOR D */
 			c.A ^= c.D;
-			c.F = (!c.A)<<7;
+			flags_or(c.A);
 			c.cycles += 1;
-		break;
-		case 0xAB:	/* XOR E */
+		NEXT;
+		OPCODE(0xAB)	/* XOR E */
 			c.A ^= c.E;
-			c.F = (!c.A)<<7;
+			flags_or(c.A);
 			c.cycles += 1;
-		break;
-		case 0xAC:	/* XOR H */
+		NEXT;
+		OPCODE(0xAC)	/* XOR H */
 			c.A ^= c.H;
-			c.F = (!c.A)<<7;
+			flags_or(c.A);
 			c.cycles += 1;
-		break;
-		case 0xAD:	/* XOR L */
+		NEXT;
+		OPCODE(0xAD)	/* XOR L */
 			c.A ^= c.L;
-			c.F = (!c.A)<<7;
+			flags_or(c.A);
 			c.cycles += 1;
-		break;
-		case 0xAE:	/* XOR (HL) */
-			c.A ^= mem_get_byte(get_HL());
-			c.F = (!c.A)<<7;
+		NEXT;
+		OPCODE(0xAE)	/* XOR (HL) */
+			t = bus_read(c.HL);
+			c.A ^= t;
+			flags_or(c.A);
 			c.cycles += 2;
-		break;
-		case 0xAF:	/* XOR A */
+		NEXT;
+		OPCODE(0xAF)	/* XOR A */
 			c.A = 0;
-			c.F = 0x80;
+			flags_or(c.A);
 			c.cycles += 1;
-		break;
-		case 0xB0:	/* OR B */
+		NEXT;
+		OPCODE(0xB0)	/* OR B */
 			c.A |= c.B;
-			c.F = (!c.A)<<7;
+			flags_or(c.A);
 			c.cycles += 1;
-		break;
-		case 0xB1:	/* OR C */
+		NEXT;
+		OPCODE(0xB1)	/* OR C */
 			c.A |= c.C;
-			c.F = (!c.A)<<7;
+			flags_or(c.A);
 			c.cycles += 1;
-		break;
-		case 0xB2:	/* OR D */
+		NEXT;
+		OPCODE(0xB2)	/* OR D */
 			c.A |= c.D;
-			c.F = (!c.A)<<7;
+			flags_or(c.A);
 			c.cycles += 1;
-		break;
-		case 0xB3:		/* OR E */
+		NEXT;
+		OPCODE(0xB3)		/* OR E */
 			c.A |= c.E;
-			c.F = (!c.A)<<7;
+			flags_or(c.A);
 			c.cycles += 1;
-		break;
-		case 0xB4:	/* OR H */
+		NEXT;
+		OPCODE(0xB4)	/* OR H */
 			c.A |= c.H;
-			c.F = (!c.A)<<7;
+			flags_or(c.A);
 			c.cycles += 1;
-		break;
-		case 0xB5:	/* OR L */
+		NEXT;
+		OPCODE(0xB5)	/* OR L */
 			c.A |= c.L;
-			c.F = (!c.A)<<7;
-			c.cycles += 1;
-		break;
-		case 0xB6:	/* OR (HL) */
-			c.A |= mem_get_byte(get_HL());
-			c.F = (!c.A)<<7;
-			c.cycles += 2;
-		break;
-		case 0xB7:	/* OR A */
-			c.F = (!c.A)<<7;
-			c.cycles += 1;
-		break;
-		case 0xB8:	/* CP B */
-			set_C((c.A - c.B) < 0);
-			set_H(((c.A - c.B)&0xF) > (c.A&0xF));
-			set_Z(c.A == c.B);
-			set_N(1);
-			c.cycles += 1;
-		break;
-		case 0xB9:	/* CP C */
-			set_Z(c.A == c.C);
-			set_H(((c.A - c.C)&0xF) > (c.A&0xF));
-			set_N(1);
-			set_C((c.A - c.C) < 0);
-			c.cycles += 1;
-		break;
-		case 0xBA:	/* CP D */
-			set_Z(c.A == c.D);
-			set_H(((c.A - c.D)&0xF) > (c.A&0xF));
-			set_N(1);
-			set_C((c.A - c.D) < 0);
-			c.cycles += 1;
-		break;
-		case 0xBB:	/* CP E */
-			set_Z(c.A == c.E);
-			set_H(((c.A - c.E)&0xF) > (c.A&0xF));
-			set_N(1);
-			set_C((c.A - c.E) < 0);
-			c.cycles += 1;
-		break;
-		case 0xBC:	/* CP H */
-			set_Z(c.A == c.H);
-			set_H(((c.A - c.H)&0xF) > (c.A&0xF));
-			set_N(1);
-			set_C((c.A - c.H) < 0);
-			c.cycles += 1;
-		break;
-		case 0xBD:	/* CP L */
-			set_Z(c.A == c.L);
-			set_H(((c.A - c.L)&0xF) > (c.A&0xF));
-			set_N(1);
-			set_C((c.A - c.L) < 0);
-			c.cycles += 1;
-		break;
-		case 0xBE:	/* CP (HL) */
-			t = mem_get_byte(get_HL());
-			set_Z(c.A == t);
-			set_H(((c.A - t)&0xF) > (c.A&0xF));
-			set_N(1);
-			set_C((c.A - t) < 0);
-			c.cycles += 2;
-		break;
-		case 0xBF:	/* CP A */
-			set_Z(1);
-			set_H(0);
-			set_N(1);
-			set_C(0);
-			c.cycles += 1;
-		break;
-		case 0xC0:	/* RET NZ */
+			flags_or(c.A);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0xB6)	/* OR (HL) */
+			t = bus_read(c.HL);
+			c.A |= t;
+			flags_or(c.A);
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0xB7)	/* OR A */
+			flags_or(c.A);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0xB8)	/* CP B */
+			i = c.A - c.B;
+			flags_sub(c.A, c.B, i);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0xB9)	/* CP C */
+			i = c.A - c.C;
+			flags_sub(c.A, c.C, i);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0xBA)	/* CP D */
+			i = c.A - c.D;
+			flags_sub(c.A, c.D, i);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0xBB)	/* CP E */
+			i = c.A - c.E;
+			flags_sub(c.A, c.E, i);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0xBC)	/* CP H */
+			i = c.A - c.H;
+			flags_sub(c.A, c.H, i);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0xBD)	/* CP L */
+			i = c.A - c.L;
+			flags_sub(c.A, c.L, i);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0xBE)	/* CP (HL) */
+			t = bus_read(c.HL);
+			i = c.A - t;
+			flags_sub(c.A, t, i);
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0xBF)	/* CP A */
+			i = c.A - c.A;
+			flags_sub(c.A, c.A, i);
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0xC0)	/* RET NZ */
 			if(!flag_Z)
 			{
-				c.PC = mem_get_word(c.SP);
+				c.PC = bus_read16(c.SP);
 				c.SP += 2;
 				c.cycles += 5;
 			} else {
 				c.cycles += 2;
 			}
-		break;
-		case 0xC1:	/* POP BC */
-			s = mem_get_word(c.SP);
-			set_BC(s);
+		NEXT;
+		OPCODE(0xC1)	/* POP BC */
+			c.BC = bus_read16(c.SP);
 			c.SP += 2;
 			c.cycles += 3;
-		break;
-		case 0xC2:	/* JP NZ, mem16 */
+		NEXT;
+		OPCODE(0xC2)	/* JP NZ, mem16 */
 			if(flag_Z == 0)
 			{
-				c.PC = mem_get_word(c.PC);
+				c.PC = IMM16;
 				c.cycles += 4;
 			} else {
-				c.PC += 2;
 				c.cycles += 3;
 			}
-		break;
-		case 0xC3:	/* JP imm16 */
-			c.PC = mem_get_word(c.PC);
+		NEXT;
+		OPCODE(0xC3)	/* JP imm16 */
+			c.PC = IMM16;
 			c.cycles += 4;
-		break;
-		case 0xC4:	/* CALL NZ, imm16 */
+		NEXT;
+		OPCODE(0xC4)	/* CALL NZ, imm16 */
 			if(flag_Z == 0)
 			{
 				c.SP -= 2;
-				mem_write_word(c.SP, c.PC+2);
-				c.PC = mem_get_word(c.PC);
+				bus_write16(c.SP, c.PC);
+				c.PC = IMM16;
 				c.cycles += 6;
 			} else {
-				c.PC += 2;
 				c.cycles += 3;
 			}
-		break;
-		case 0xC5:	/* PUSH BC */
+		NEXT;
+		OPCODE(0xC5)	/* PUSH BC */
 			c.SP -= 2;
-			mem_write_word(c.SP, get_BC());
+			bus_write16(c.SP, c.BC);
 			c.cycles += 4;
-		break;
-		case 0xC6:	/* ADD A, imm8 */
-			t = mem_get_byte(c.PC++);
-			set_C((c.A + t) >= 0x100);
-			set_H(((c.A + t)&0xF) < (c.A&0xF));
-			c.A += t;
-			set_N(0);
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0xC6)	/* ADD A, imm8 */
+			t = IMM8;
+			i = c.A + t;
+			flags_add(c.A, t, i);
+			c.A = i;
 			c.cycles += 2;
-		break;
-		case 0xC7:	/* RST 00 */
+		NEXT;
+		OPCODE(0xC7)	/* RST 00 */
 			c.SP -= 2;
-			mem_write_word(c.SP, c.PC);
+			bus_write16(c.SP, c.PC);
 			c.PC = 0;
 			c.cycles += 4;
-		break;
-		case 0xC8:	/* RET Z */
+		NEXT;
+		OPCODE(0xC8)	/* RET Z */
 			if(flag_Z == 1)
 			{
-				c.PC = mem_get_word(c.SP);
+				c.PC = bus_read16(c.SP);
 				c.SP += 2;
 				c.cycles += 5;
 			} else {
 				c.cycles += 2;
 			}
-		break;
-		case 0xC9:	/* RET */
-			c.PC = mem_get_word(c.SP);
+		NEXT;
+		OPCODE(0xC9)	/* RET */
+			c.PC = bus_read16(c.SP);
 			c.SP += 2;
 			c.cycles += 4;
-		break;
-		case 0xCA:	/* JP z, mem16 */
+		NEXT;
+		OPCODE(0xCA)	/* JP z, mem16 */
 			if(flag_Z == 1)
 			{
-				c.PC = mem_get_word(c.PC);
+				c.PC = IMM16;
 				c.cycles += 4;
 			} else {
-				c.PC += 2;
 				c.cycles += 3;
 			}
-		break;
-		case 0xCB:	/* RLC/RRC/RL/RR/SLA/SRA/SWAP/SRL/BIT/RES/SET */
-			decode_CB(mem_get_byte(c.PC++));
-			c.cycles += 1;
-		break;
-		case 0xCC:	/* CALL Z, imm16 */
+		NEXT;
+		OPCODE(0xCB)	/* RLC/RRC/RL/RR/SLA/SRA/SWAP/SRL/BIT/RES/SET */
+			/* 2 M-cycles, (HL) operands 4, or 3 for BIT */
+			t = IMM8;
+			cb_ops<P>::table[t]();
+			c.cycles += (t&7) != 6 ? 2 : (t&0xC0) == 0x40 ? 3 : 4;
+		NEXT;
+		OPCODE(0xCC)	/* CALL Z, imm16 */
 			if(flag_Z == 1)
 			{
 				c.SP -= 2;
-				mem_write_word(c.SP, c.PC+2);
-				c.PC = mem_get_word(c.PC);
+				bus_write16(c.SP, c.PC);
+				c.PC = IMM16;
 				c.cycles += 6;
 			} else {
-				c.PC += 2;
 				c.cycles += 3;
 			}
-		break;
-		case 0xCD:	/* call imm16 */
+		NEXT;
+		OPCODE(0xCD)	/* call imm16 */
 			c.SP -= 2;
-			mem_write_word(c.SP, c.PC+2);
-			c.PC = mem_get_word(c.PC);
+			bus_write16(c.SP, c.PC);
+			c.PC = IMM16;
 			c.cycles += 6;
-		break;
-		case 0xCE:	/* ADC a, imm8 */
-			t = mem_get_byte(c.PC++);
-			i = c.A + t + flag_C >= 0x100;
-			set_N(0);
-			set_H(((c.A&0xF) + (t&0xF) + flag_C) >= 0x10);
-			c.A = c.A + t + flag_C;
-			set_C(i);
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0xCE)	/* ADC a, imm8 */
+			t = IMM8;
+			i = c.A + t + flag_C;
+			flags_add(c.A, t, i);
+			c.A = i;
 			c.cycles += 2;
-		break;
-		case 0xCF:	/* RST 08 */
+		NEXT;
+		OPCODE(0xCF)	/* RST 08 */
 			c.SP -= 2;
-			mem_write_word(c.SP, c.PC);
+			bus_write16(c.SP, c.PC);
 			c.PC = 0x0008;
 			c.cycles += 4;
-		break;
-		case 0xD0:	/* RET NC */
+		NEXT;
+		OPCODE(0xD0)	/* RET NC */
 			if(flag_C == 0)
 			{
-				c.PC = mem_get_word(c.SP);
+				c.PC = bus_read16(c.SP);
 				c.SP += 2;
 				c.cycles += 5;
 			} else {
 				c.cycles += 2;
 			}
-		break;
-		case 0xD1:	/* POP DE */
-			s = mem_get_word(c.SP);
-			set_DE(s);
+		NEXT;
+		OPCODE(0xD1)	/* POP DE */
+			c.DE = bus_read16(c.SP);
 			c.SP += 2;
 			c.cycles += 3;
-		break;
-		case 0xD2:	/* JP NC, mem16 */
+		NEXT;
+		OPCODE(0xD2)	/* JP NC, mem16 */
 			if(flag_C == 0)
 			{
-				c.PC = mem_get_word(c.PC);
+				c.PC = IMM16;
 				c.cycles += 4;
 			} else {
-				c.PC += 2;
 				c.cycles += 3;
 			}
-		break;
-		case 0xD3:	/* Invalid opcode */
+		NEXT;
+		OPCODE(0xD3)	/* Invalid opcode */
 			Serial.printf("CPU: Invalid opcode 0xD3 at PC=0x%04X (treating as NOP)\n", c.PC-1);
 			c.cycles += 1;
-		break;
-		case 0xD4:	/* CALL NC, mem16 */
+		NEXT;
+		OPCODE(0xD4)	/* CALL NC, mem16 */
 			if(flag_C == 0)
 			{
 				c.SP -= 2;
-				mem_write_word(c.SP, c.PC+2);
-				c.PC = mem_get_word(c.PC);
+				bus_write16(c.SP, c.PC);
+				c.PC = IMM16;
 				c.cycles += 6;
 			} else {
-				c.PC += 2;
 				c.cycles += 3;
 			}
-		break;
-		case 0xD5:	/* PUSH DE */
+		NEXT;
+		OPCODE(0xD5)	/* PUSH DE */
 			c.SP -= 2;
-			mem_write_word(c.SP, get_DE());
+			bus_write16(c.SP, c.DE);
 			c.cycles += 4;
-		break;
-		case 0xD6:	/* SUB A, imm8 */
-			t = mem_get_byte(c.PC++);
-			set_C((c.A - t) < 0);
-			set_H(((c.A - t)&0xF) > (c.A&0xF));
-			c.A -= t;
-			set_N(1);
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0xD6)	/* SUB A, imm8 */
+			t = IMM8;
+			i = c.A - t;
+			flags_sub(c.A, t, i);
+			c.A = i;
 			c.cycles += 2;
-		break;
-		case 0xD7:	/* RST 10 */
+		NEXT;
+		OPCODE(0xD7)	/* RST 10 */
 			c.SP -= 2;
-			mem_write_word(c.SP, c.PC);
+			bus_write16(c.SP, c.PC);
 			c.PC = 0x0010;
 			c.cycles += 4;
-		break;
-		case 0xD8:	/* RET C */
+		NEXT;
+		OPCODE(0xD8)	/* RET C */
 			if(flag_C == 1)
 			{
-				c.PC = mem_get_word(c.SP);
+				c.PC = bus_read16(c.SP);
 				c.SP += 2;
 				c.cycles += 5;
 			} else {
 				c.cycles += 2;
 			}
-		break;
-		case 0xD9:	/* RETI */
-			c.PC = mem_get_word(c.SP);
+		NEXT;
+		OPCODE(0xD9)	/* RETI */
+			c.PC = bus_read16(c.SP);
 			c.SP += 2;
 			c.cycles += 4;
 			IME = 1;
-		break;
-		case 0xDA:	/* JP C, mem16 */
+			interrupt_update();
+		NEXT;
+		OPCODE(0xDA)	/* JP C, mem16 */
 			if(flag_C)
 			{
-				c.PC = mem_get_word(c.PC);
+				c.PC = IMM16;
 				c.cycles += 4;
 			} else {
-				c.PC += 2;
 				c.cycles += 3;
 			}
-		break;
-		case 0xDB:	/* Invalid opcode */
+		NEXT;
+		OPCODE(0xDB)	/* Invalid opcode */
 			Serial.printf("CPU: Invalid opcode 0xDB at PC=0x%04X (treating as NOP)\n", c.PC-1);
 			c.cycles += 1;
-		break;
-		case 0xDC:	/* CALL C, mem16 */
+		NEXT;
+		OPCODE(0xDC)	/* CALL C, mem16 */
 			if(flag_C == 1)
 			{
 				c.SP -= 2;
-				mem_write_word(c.SP, c.PC+2);
-				c.PC = mem_get_word(c.PC);
+				bus_write16(c.SP, c.PC);
+				c.PC = IMM16;
 				c.cycles += 6;
 			} else {
-				c.PC += 2;
 				c.cycles += 3;
 			}
-		break;
-		case 0xDD:	/* Invalid opcode */
+		NEXT;
+		OPCODE(0xDD)	/* Invalid opcode */
 			Serial.printf("CPU: Invalid opcode 0xDD at PC=0x%04X (treating as NOP)\n", c.PC-1);
 			c.cycles += 1;
-		break;
-		case 0xDE:	/* SBC A, imm8 */
-			t = mem_get_byte(c.PC++);
-			b = flag_C;
-			set_H(((t&0xF) + flag_C) > (c.A&0xF));
-			set_C(t + flag_C > c.A);
-			set_N(1);
-			c.A -= (b + t);
-			set_Z(!c.A);
+		NEXT;
+		OPCODE(0xDE)	/* SBC A, imm8 */
+			t = IMM8;
+			i = c.A - t - flag_C;
+			flags_sub(c.A, t, i);
+			c.A = i;
 			c.cycles += 2;
-		break;
-		case 0xDF:	/* RST 18 */
+		NEXT;
+		OPCODE(0xDF)	/* RST 18 */
 			c.SP -= 2;
-			mem_write_word(c.SP, c.PC);
+			bus_write16(c.SP, c.PC);
 			c.PC = 0x0018;
 			c.cycles += 4;
-		break;
-		case 0xE0:	/* LD (FF00 + imm8), A */
-			t = mem_get_byte(c.PC++);
-			mem_write_byte(0xFF00 + t, c.A);
+		NEXT;
+		OPCODE(0xE0)	/* LD (FF00 + imm8), A */
+			t = IMM8;
+			bus_write(0xFF00 + t, c.A);
 			c.cycles += 3;
-		break;
-		case 0xE1:	/* POP HL */
-			i = mem_get_word(c.SP);
-			set_HL(i);
+		NEXT;
+		OPCODE(0xE1)	/* POP HL */
+			c.HL = bus_read16(c.SP);
 			c.SP += 2;
 			c.cycles += 3;
-		break;
-		case 0xE2:	/* LD (FF00 + C), A */
-			mem_write_byte(0xFF00 + c.C, c.A);
+		NEXT;
+		OPCODE(0xE2)	/* LD (FF00 + C), A */
+			bus_write(0xFF00 + c.C, c.A);
 			c.cycles += 2;
-		break;
-		case 0xE3:	/* Invalid opcode */
+		NEXT;
+		OPCODE(0xE3)	/* Invalid opcode */
 			Serial.printf("CPU: Invalid opcode 0xE3 at PC=0x%04X (treating as NOP)\n", c.PC-1);
 			c.cycles += 1;
-		break;
-		case 0xE4:	/* Invalid opcode */
+		NEXT;
+		OPCODE(0xE4)	/* Invalid opcode */
 			Serial.printf("CPU: Invalid opcode 0xE4 at PC=0x%04X (treating as NOP)\n", c.PC-1);
 			c.cycles += 1;
-		break;
-		case 0xE5:	/* PUSH HL */
+		NEXT;
+		OPCODE(0xE5)	/* PUSH HL */
 			c.SP -= 2;
-			mem_write_word(c.SP, get_HL());
+			bus_write16(c.SP, c.HL);
 			c.cycles += 4;
-		break;
-		case 0xE6:	/* AND A, imm8 */
-			t = mem_get_byte(c.PC++);
-			set_N(0);
-			set_H(1);
-			set_C(0);
-			c.A = t & c.A;
-			set_Z(!c.A);
-			c.cycles += 2;
-		break;
-		case 0xE7:	/* RST 20 */
+		NEXT;
+		OPCODE(0xE6)	/* AND A, imm8 */
+			t = IMM8;
+			c.A &= t;
+			flags_and(c.A);
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0xE7)	/* RST 20 */
 			c.SP -= 2;
-			mem_write_word(c.SP, c.PC);
+			bus_write16(c.SP, c.PC);
 			c.PC = 0x20;
 			c.cycles += 4;
-		break;
-		case 0xE8:	/* ADD SP, imm8 */
-			i = mem_get_byte(c.PC++);
+		NEXT;
+		OPCODE(0xE8)	/* ADD SP, imm8 */
+			i = IMM8;
 			set_Z(0);
 			set_N(0);
 			set_C(((c.SP+i)&0xFF) < (c.SP&0xFF));
 			set_H(((c.SP+i)&0xF) < (c.SP&0xF));
 			c.SP = c.SP + (signed char)i;
 			c.cycles += 4;
-		break;
-		case 0xE9:	/* JP HL */
-			c.PC = get_HL();
-			c.cycles += 1;
-		break;
-		case 0xEA:	/* LD (mem16), a */
-			s = mem_get_word(c.PC);
-			mem_write_byte(s, c.A);
-			c.PC += 2;
+		NEXT;
+		OPCODE(0xE9)	/* JP HL */
+			c.PC = c.HL;
+			c.cycles += 1;
+		NEXT;
+		OPCODE(0xEA)	/* LD (mem16), a */
+			s = IMM16;
+			bus_write(s, c.A);
 			c.cycles += 4;
-		break;
-		case 0xEB:	/* Invalid opcode */
+		NEXT;
+		OPCODE(0xEB)	/* Invalid opcode */
 			Serial.printf("CPU: Invalid opcode 0xEB at PC=0x%04X (treating as NOP)\n", c.PC-1);
 			c.cycles += 1;
-		break;
-		case 0xEC:	/* Invalid opcode */
+		NEXT;
+		OPCODE(0xEC)	/* Invalid opcode */
 			Serial.printf("CPU: Invalid opcode 0xEC at PC=0x%04X (treating as NOP)\n", c.PC-1);
 			c.cycles += 1;
-		break;
-		case 0xED:	/* Invalid opcode */
+		NEXT;
+		OPCODE(0xED)	/* Invalid opcode */
 			Serial.printf("CPU: Invalid opcode 0xED at PC=0x%04X (treating as NOP)\n", c.PC-1);
 			c.cycles += 1;
-		break;
-		case 0xEE:	/* XOR A, imm8 */
-			c.A ^= mem_get_byte(c.PC++);
-			c.F = (!c.A)<<7;
+		NEXT;
+		OPCODE(0xEE)	/* XOR A, imm8 */
+			t = IMM8;
+			c.A ^= t;
+			flags_or(c.A);
 			c.cycles += 2;
-		break;
-		case 0xEF:	/* RST 28 */
+		NEXT;
+		OPCODE(0xEF)	/* RST 28 */
 			c.SP -= 2;
-			mem_write_word(c.SP, c.PC);
+			bus_write16(c.SP, c.PC);
 			c.PC = 0x28;
 			c.cycles += 4;
-		break;
-		case 0xF0:	/* LD A, (FF00 + imm8) */
-			t = mem_get_byte(c.PC++);
-			c.A = mem_get_byte(0xFF00 + t);
+		NEXT;
+		OPCODE(0xF0)	/* LD A, (FF00 + imm8) */
+			t = IMM8;
+			c.A = bus_read(0xFF00 + t);
 			c.cycles += 3;
-		break;
-		case 0xF1:	/* POP AF */
-			s = mem_get_word(c.SP);
+		NEXT;
+		OPCODE(0xF1)	/* POP AF */
+			s = bus_read16(c.SP);
 			set_AF(s&0xFFF0);
 			c.SP += 2;
 			c.cycles += 3;
-		break;
-		case 0xF2:	/* LD A, (FF00 + c) */
-			c.A = mem_get_byte(0xFF00 + c.C);
+		NEXT;
+		OPCODE(0xF2)	/* LD A, (FF00 + c) */
+			c.A = bus_read(0xFF00 + c.C);
 			c.cycles += 2;
-		break;
-		case 0xF3:	/* DI */
+		NEXT;
+		OPCODE(0xF3)	/* DI */
 			c.cycles += 1;
+			/* Also cancels an EI that hasn't taken effect yet */
 			IME = 0;
-		break;
-		case 0xF4:	/* Invalid opcode */
+			ime_delay = 0;
+			interrupt_update();
+		NEXT;
+		OPCODE(0xF4)	/* Invalid opcode */
 			Serial.printf("CPU: Invalid opcode 0xF4 at PC=0x%04X (treating as NOP)\n", c.PC-1);
 			c.cycles += 1;
-		break;
-		case 0xF5:	/* PUSH AF */
+		NEXT;
+		OPCODE(0xF5)	/* PUSH AF */
 			c.SP -= 2;
-			mem_write_word(c.SP, get_AF());
+			bus_write16(c.SP, get_AF());
 			c.cycles += 4;
-		break;
-		case 0xF6:	/* OR A, imm8 */
-			c.A |= mem_get_byte(c.PC++);
-			c.F = (!c.A)<<7;
-			c.cycles += 2;
-		break;
-		case 0xF7:	/* RST 30 */
+		NEXT;
+		OPCODE(0xF6)	/* OR A, imm8 */
+			t = IMM8;
+			c.A |= t;
+			flags_or(c.A);
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0xF7)	/* RST 30 */
 			c.SP -= 2;
-			mem_write_word(c.SP, c.PC);
+			bus_write16(c.SP, c.PC);
 			c.PC = 0x30;
 			c.cycles += 4;
-		break;
-		case 0xF8:	/* LD HL, SP + imm8 */
-			i = mem_get_byte(c.PC++);
+		NEXT;
+		OPCODE(0xF8)	/* LD HL, SP + imm8 */
+			i = IMM8;
 			set_N(0);
 			set_Z(0);
 			set_C(((c.SP+i)&0xFF) < (c.SP&0xFF));
 			set_H(((c.SP+i)&0xF) < (c.SP&0xF));
-			set_HL(c.SP + (signed char)i);
+			c.HL = c.SP + (signed char)i;
 			c.cycles += 3;
-		break;
-		case 0xF9:	/* LD SP, HL */
-			c.SP = get_HL();
-			c.cycles += 2;
-		break;
-		case 0xFA:	/* LD A, (mem16) */
-			s = mem_get_word(c.PC);
-			c.A = mem_get_byte(s);
-			c.PC += 2;
+		NEXT;
+		OPCODE(0xF9)	/* LD SP, HL */
+			c.SP = c.HL;
+			c.cycles += 2;
+		NEXT;
+		OPCODE(0xFA)	/* LD A, (mem16) */
+			s = IMM16;
+			c.A = bus_read(s);
 			c.cycles += 4;
-		break;
-		case 0xFB:	/* EI */
+		NEXT;
+		OPCODE(0xFB)	/* EI */
 			interrupt_enable();
 			c.cycles += 1;
-		break;
-		case 0xFC:	/* Invalid opcode */
+		NEXT;
+		OPCODE(0xFC)	/* Invalid opcode */
 			Serial.printf("CPU: Invalid opcode 0xFC at PC=0x%04X (treating as NOP)\n", c.PC-1);
 			c.cycles += 1;
-		break;
-		case 0xFD:	/* Invalid opcode */
+		NEXT;
+		OPCODE(0xFD)	/* Invalid opcode */
 			Serial.printf("CPU: Invalid opcode 0xFD at PC=0x%04X (treating as NOP)\n", c.PC-1);
 			c.cycles += 1;
-		break;
-		case 0xFE:	/* CP a, imm8 */
-			t = mem_get_byte(c.PC++);
-			set_Z(c.A == t);
-			set_N(1);
-			set_H(((c.A - t)&0xF) > (c.A&0xF));
-			set_C(c.A < t);
+		NEXT;
+		OPCODE(0xFE)	/* CP a, imm8 */
+			t = IMM8;
+			i = c.A - t;
+			flags_sub(c.A, t, i);
 			c.cycles += 2;
-		break;
-		case 0xFF:	/* RST 38 */
+		NEXT;
+		OPCODE(0xFF)	/* RST 38 */
 			c.SP -= 2;
-			mem_write_word(c.SP, c.PC);
+			bus_write16(c.SP, c.PC);
 			c.PC = 0x0038;
 			c.cycles += 4;
-		break;
+		NEXT;
+#if CPU_FUSION
+#define FUSED_DEC_JR(n, r, name) \
+		FUSED(n)	/* DEC name ; JR NZ */ \
+			do { \
+				t = r--; \
+				flags_dec(t, r); \
+				c.cycles += 1; \
+				FUSE_NEXT; \
+				if (flag_Z == 0) \
+					jr_taken(IMM8); \
+				else \
+					c.cycles += 2; \
+			} while (0); \
+		NEXT;
+		FUSED_DEC_JR(0x05, c.B, B)
+		FUSED_DEC_JR(0x0D, c.C, C)
+		FUSED_DEC_JR(0x15, c.D, D)
+		FUSED_DEC_JR(0x1D, c.E, E)
+		FUSED_DEC_JR(0x25, c.H, H)
+		FUSED_DEC_JR(0x2D, c.L, L)
+		FUSED_DEC_JR(0x3D, c.A, A)
+#undef FUSED_DEC_JR
+		FUSED(0x0B)	/* DEC BC ; LD A,B ; OR C ; JR NZ */
+			do {
+				c.BC--;
+				c.cycles += 2;
+				FUSE_NEXT;
+				c.A = c.B;
+				c.cycles += 1;
+				FUSE_NEXT;
+				c.A |= c.C;
+				flags_or(c.A);
+				c.cycles += 1;
+				FUSE_NEXT;
+				if (flag_Z == 0)
+					jr_taken(IMM8);
+				else
+					c.cycles += 2;
+			} while (0);
+		NEXT;
+		FUSED(0x1B)	/* DEC DE ; LD A,D ; OR E ; JR NZ */
+			do {
+				c.DE--;
+				c.cycles += 2;
+				FUSE_NEXT;
+				c.A = c.D;
+				c.cycles += 1;
+				FUSE_NEXT;
+				c.A |= c.E;
+				flags_or(c.A);
+				c.cycles += 1;
+				FUSE_NEXT;
+				if (flag_Z == 0)
+					jr_taken(IMM8);
+				else
+					c.cycles += 2;
+			} while (0);
+		NEXT;
+		FUSED(0x2A)	/* LD A,(HL+) ; LD (DE),A ; INC DE */
+			do {
+				c.A = bus_read(c.HL++);
+				c.cycles += 2;
+				FUSE_NEXT;
+				bus_write(c.DE, c.A);
+				c.cycles += 2;
+				FUSE_NEXT;
+				c.DE++;
+				c.cycles += 2;
+			} while (0);
+		NEXT;
+		FUSED(0xF0)	/* LDH A,(n) ; CP n ; JR cc */
+			do {
+				c.A = bus_read(0xFF00 + IMM8);
+				c.cycles += 3;
+				FUSE_NEXT;
+				i = c.A - IMM8;
+				flags_sub(c.A, IMM8, i);
+				c.cycles += 2;
+				FUSE_NEXT;
+				if (jr_condition(blocks.cur->op))
+					jr_taken(IMM8);
+				else
+					c.cycles += 2;
+			} while (0);
+		NEXT;
+#if CPU_THREADED_DISPATCH
+		fused_none:
+			/* Not reachable, only fused_length() sequences are flagged */
+			c.cycles += 1;
+		NEXT;
+#endif
+#endif
+#if !CPU_THREADED_DISPATCH
 		default: {
 			static char errstr[50];
 			sprintf(errstr, "Unhandled opcode: %02X at %04X.", b, c.PC-1);
@@ -2417,19 +2631,36 @@ uint32_t cpu_cycle(void)
 			// Don't crash immediately - treat as NOP and continue
 			c.cycles += 1;
 		}
-		break;
+		NEXT;
+#endif
 	}
+	goto next_instruction;
 
+#undef OPCODE
+#undef FUSED
+#undef FUSE_NEXT
+#undef NEXT
+
+done:
 	uint32_t delta = (c.cycles - c.lastcycles);
 	c.lastcycles = c.cycles;
-	
-	// Debug cycle output occasionally
-	static uint32_t debug_cycle_count = 0;
-	debug_cycle_count++;
-	if (debug_cycle_count % 50000 == 0) {
-		Serial.printf("CPU_DEBUG: Instruction %d returned %d cycles, total c.cycles=%d\n", 
-		              debug_cycle_count, delta, c.cycles);
-	}
-	
 	return delta;
 }
+
+uint32_t cpu_run(uint32_t cycle_budget)
+{
+	return Core<CpuPolicy>::run(cycle_budget);
+}
+
+/* Ends the current cpu_run() after the instruction being executed, used
+ * when a register write changes when the next peripheral event is due */
+void cpu_break(void)
+{
+	c.target = c.cycles;
+}
+
+uint32_t cpu_cycle(void)
+{
+	/* Every instruction takes at least one cycle, so this runs exactly one */
+	return cpu_run(1);
+}
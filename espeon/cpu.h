@@ -7,7 +7,22 @@ extern bool halted;
 
 void cpu_init(void);
 uint32_t cpu_cycle(void);
+uint32_t cpu_run(uint32_t cycle_budget);
+void cpu_break(void);
 uint32_t cpu_get_cycles(void);
+uint16_t cpu_get_pc(void);
+uint32_t cpu_get_instruction_count(void);
+/* M-cycles spent halted that were skipped rather than stepped */
+uint64_t cpu_get_halt_skipped_cycles(void);
+/* M-cycles skipped in LY/STAT/IF polling loops */
+uint64_t cpu_get_idle_skipped_cycles(void);
 void cpu_interrupt(uint16_t);
+/* Drops the cached fetch pointer, called when the memory map changes */
+void cpu_flush_fetch(void);
+/* Drops all pre-decoded ROM code, for when ROM contents change */
+void cpu_flush_blocks(void);
+uint32_t cpu_get_block_hits(void);
+uint32_t cpu_get_block_misses(void);
+const uint32_t* cpu_get_opcode_pairs(void);
 
 #endif
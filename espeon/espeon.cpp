@@ -18,6 +18,7 @@
 #include "interrupt.h"
 #include "mbc.h"
 #include "rom.h"
+#include "trace.h"
 
 // TFT_eSPI instance for CYD display
 TFT_eSPI tft = TFT_eSPI();
@@ -269,6 +270,8 @@ void espeon_update(void)
 
 void espeon_faint(const char* msg)
 {
+	Serial.printf("Espeon fainted: %s\n", msg);
+	trace_dump();
 	tft.fillScreen(TFT_BLACK);
 	tft.setCursor(2, 2);
 	tft.setTextColor(TFT_WHITE);
@@ -875,7 +878,7 @@ const uint8_t* espeon_load_rom(const char* path)
 		Serial.printf("ROM: Bank 0 loaded, first bytes: %02X %02X %02X %02X\n",
 		              rom_bank0_permanent[0], rom_bank0_permanent[1], 
 		              rom_bank0_permanent[2], rom_bank0_permanent[3]);
-		Serial.printf("ROM: Bank 0 address 0x0038: %02X (should NOT be 0xFF)\n", rom_bank0_permanent[0x0038]);
+		Serial.printf("ROM: Bank 0 address 0x0038: %02X\n", rom_bank0_permanent[0x0038]);
 		Serial.printf("ROM: Nintendo logo check (0x0104): %02X %02X %02X %02X\n",
 		              rom_bank0_permanent[0x0104], rom_bank0_permanent[0x0105], 
 		              rom_bank0_permanent[0x0106], rom_bank0_permanent[0x0107]);
@@ -904,19 +907,10 @@ const uint8_t* espeon_load_rom(const char* path)
 		
 		if (has_ff_padding) {
 			Serial.println("ROM: This ROM has 0xFF padding in interrupt vector area (normal for many ROMs)");
-			Serial.println("ROM: Bootrom disable will use selective copying to preserve safety vectors");
 		} else {
 			Serial.println("ROM: This ROM has valid interrupt vectors in ROM bank 0");
 		}
 		
-		// Critical safety check
-		if (rom_bank0_permanent[0x0038] == 0xFF) {
-			Serial.println("WARNING: ROM bank 0 has 0xFF at address 0x0038!");
-			Serial.println("WARNING: This may cause infinite RST 38 loop during emulation!");
-			Serial.println("WARNING: Patching ROM bank 0 with NOP at 0x0038 to prevent infinite loop");
-			rom_bank0_permanent[0x0038] = 0x00; // Patch with NOP to prevent infinite loop
-		}
-		
 		spi_release_lock();
 		
 		// Show success message
@@ -1170,23 +1164,6 @@ const uint8_t* espeon_get_rom_bank(uint16_t bank_number) {
 	}
 }
 
-// Pre-allocated main memory management  
-static uint8_t* preallocated_main_mem = nullptr;
-
-void espeon_set_preallocated_main_mem(uint8_t* mem) {
-	preallocated_main_mem = mem;
-	Serial.printf("Set pre-allocated main memory: %p\n", mem);
-}
-
-uint8_t* espeon_get_preallocated_main_mem() {
-	if (preallocated_main_mem) {
-		uint8_t* mem = preallocated_main_mem;
-		preallocated_main_mem = nullptr; // Transfer ownership
-		return mem;
-	}
-	return nullptr;
-}
-
 // Pre-allocated MBC RAM management
 static uint8_t* preallocated_mbc_ram = nullptr;
 static size_t preallocated_mbc_size = 0;
@@ -30,8 +30,6 @@ void espeon_set_brightness_digital(bool on); // Alternative for troubleshooting
 void espeon_cleanup_rom();
 void espeon_cleanup_spi();
 void espeon_check_memory();
-void espeon_set_preallocated_main_mem(uint8_t* mem);
-uint8_t* espeon_get_preallocated_main_mem();
 void espeon_set_preallocated_mbc_ram(uint8_t* ram, size_t size);
 uint8_t* espeon_get_preallocated_mbc_ram(size_t* size);
 
@@ -4,9 +4,11 @@
 #include "rom.h"
 #include "mem.h"
 #include "cpu.h"
+#include "gb.h"
 #include "lcd.h"
-#include "interrupt.h"
 #include "espeon.h"
+#include "supervisor.h"
+#include "profiler.h"
 // DISABLED: #include "menu.h"  // Touch menu system disabled to avoid SPI conflicts
 
 #include "gbfiles.h"
@@ -18,25 +20,12 @@ void setup()
 {
 	espeon_init();
 	
-	// **CRITICAL MEMORY ALLOCATION STRATEGY**
-	// Allocate large memory blocks EARLY before fragmentation occurs
+	// Allocate the largest block EARLY before fragmentation occurs. The
+	// MMU's regions are small enough to be allocated by mmu_init().
 	Serial.println("=== EARLY MEMORY ALLOCATION ===");
 	size_t initial_heap = ESP.getFreeHeap();
 	Serial.printf("Initial free heap: %d bytes\n", initial_heap);
 	
-	// Pre-allocate Game Boy main memory (64KB) - most critical allocation
-	Serial.println("Pre-allocating Game Boy main memory (64KB)...");
-	uint8_t* early_main_mem = (uint8_t*)calloc(1, 0x10000);
-	if (early_main_mem) {
-		Serial.printf("SUCCESS: Pre-allocated 64KB main memory at %p\n", early_main_mem);
-		espeon_set_preallocated_main_mem(early_main_mem);
-	} else {
-		Serial.println("CRITICAL: Failed to pre-allocate main memory!");
-		Serial.printf("Available heap: %d, largest block: %d\n", 
-		              ESP.getFreeHeap(), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
-		// Continue anyway, but this will likely fail later
-	}
-	
 	// Pre-allocate MBC RAM (32KB max for largest cartridges)
 	Serial.println("Pre-allocating MBC RAM (32KB)...");
 	size_t mbc_ram_needed = 32*1024; 
@@ -183,36 +172,18 @@ void setup()
 	
 	Serial.println("Initializing CPU...");
 	cpu_init();
+	gb_init();
 	Serial.println("CPU initialization complete!");
 	
 	espeon_render_border((const uint8_t*)gb_border, gb_border_size);
 	
 	while(true) {
-		uint32_t cycles = cpu_cycle();
-		espeon_update();
-		lcd_cycle(cycles);
-		timer_cycle(cycles);
+		gb_run_frame();
+		supervisor_frame();
+		profiler_frame();
 		
-		// Force VBlank interrupt occasionally to help break infinite loops, but let LCD timing control LY
-		static uint32_t last_vblank_time = 0;
-		static uint32_t frame_counter = 0;
-		uint32_t current_time = millis();
-		
-		// Generate VBlank every ~16.7ms but don't interfere with natural LY progression
-		uint32_t vblank_interval = 16 + (frame_counter % 4 == 0 ? 1 : 0);
-		if (current_time - last_vblank_time >= vblank_interval) {
-			// Only force VBlank interrupt, let lcd_cycle() handle LY updates naturally
-			interrupt(0x01); // Force VBlank interrupt
-			last_vblank_time = current_time;
-			frame_counter++;
-		}
-		
-		// Yield occasionally to prevent watchdog timeouts
-		static uint32_t yield_counter = 0;
-		if (++yield_counter >= 50) { // More frequent yielding
-			yield_counter = 0;
-			yield();
-		}
+		// Yield once per frame to prevent watchdog timeouts
+		yield();
 	}
 }
 
@@ -0,0 +1,118 @@
+#include "gb.h"
+#include "cpu.h"
+#include "lcd.h"
+#include "timer.h"
+#include "mem.h"
+#include "interrupt.h"
+#include "sched.h"
+#include "espeon.h"
+
+#define FRAME_CYCLES		(154*456/4)
+#define INPUT_POLL_CYCLES	(16*456/4)
+
+/* CPU cycle count the LCD and the timer have been advanced to */
+static uint32_t lcd_synced;
+static uint32_t timer_synced;
+static uint32_t frame_end;
+
+bool gb_lockstep;
+
+/* Per-run counts of catch-ups that actually advanced a peripheral */
+uint32_t gb_lcd_syncs;
+uint32_t gb_timer_syncs;
+
+static void input_poll(void)
+{
+	espeon_update();
+	sched_in(SCHED_INPUT, INPUT_POLL_CYCLES);
+}
+
+/* After mmu_init(), lcd_init() and cpu_init() */
+void gb_init(void)
+{
+	sched_init();
+	lcd_synced = timer_synced = cpu_get_cycles();
+	frame_end = lcd_synced;
+	gb_lcd_syncs = gb_timer_syncs = 0;
+	timer_init();
+	interrupt_init();
+	sched_handler_set(SCHED_INPUT, input_poll);
+	/* Both work out their next event when they first run */
+	sched_in(SCHED_LCD, 0);
+	sched_in(SCHED_INPUT, 0);
+}
+
+/* Catch-up. Batches end on the LCD and timer events, so these never skip
+ * over a mode change or timer overflow and are safe to call from register
+ * accessors in the middle of a batch. */
+void gb_sync_lcd(void)
+{
+	uint32_t delta = cpu_get_cycles() - lcd_synced;
+	if (!delta)
+		return;
+	lcd_synced += delta;
+	gb_lcd_syncs++;
+	lcd_cycle(delta);
+}
+
+void gb_sync_timer(void)
+{
+	uint32_t delta = cpu_get_cycles() - timer_synced;
+	if (!delta)
+		return;
+	timer_synced += delta;
+	gb_timer_syncs++;
+	timer_cycle(delta);
+}
+
+void gb_sync(void)
+{
+	gb_sync_lcd();
+	gb_sync_timer();
+}
+
+/* Reference for the lazy catch-up: every instruction is followed by the
+ * LCD and timer being brought up to date */
+static void run_lockstep(uint64_t end)
+{
+	while (sched_now() < end) {
+		cpu_run(1);
+		gb_sync();
+		sched_dispatch();
+	}
+}
+
+/* Runs the CPU for cycle_budget cycles in batches that end on the next
+ * scheduled event, handing control to the peripherals only when one of
+ * them has something to do. Between events the LCD and timer are only
+ * caught up when the CPU touches their registers; everything is caught
+ * up at the end. Returns the cycles executed. */
+uint32_t gb_run(uint32_t cycle_budget)
+{
+	const uint32_t start = cpu_get_cycles();
+	const uint64_t end = sched_now() + cycle_budget;
+
+	if (gb_lockstep) {
+		run_lockstep(end);
+	} else {
+		for (;;) {
+			sched_dispatch();
+
+			uint64_t now = sched_now();
+			if (now >= end)
+				break;
+			uint64_t next = sched_next();
+			cpu_run((next < end ? next : end) - now);
+		}
+	}
+	gb_sync();
+
+	return cpu_get_cycles() - start;
+}
+
+void gb_run_frame(void)
+{
+	frame_end += FRAME_CYCLES;
+	if ((int32_t)(frame_end - cpu_get_cycles()) > 0)
+		gb_run(frame_end - cpu_get_cycles());
+}
@@ -0,0 +1,24 @@
+#ifndef GB_H
+#define GB_H
+
+#include <stdint.h>
+
+void gb_init(void);
+void gb_run_frame(void);
+uint32_t gb_run(uint32_t cycle_budget);
+
+/* The LCD and timer only run when something needs their state: their
+ * registers are accessed, one of their events is due or gb_run() returns.
+ * These bring one or both up to the current CPU cycle. */
+void gb_sync(void);
+void gb_sync_lcd(void);
+void gb_sync_timer(void);
+
+/* Set to catch the LCD and timer up after every instruction instead, the
+ * reference host/synccheck compares the lazy catch-up against */
+extern bool gb_lockstep;
+/* Catch-ups that advanced the LCD or timer since gb_init() */
+extern uint32_t gb_lcd_syncs;
+extern uint32_t gb_timer_syncs;
+
+#endif
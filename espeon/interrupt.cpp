@@ -1,22 +1,28 @@
 #include "interrupt.h"
 #include "cpu.h"
+#include "mem.h"
+#include "gb.h"
 
 uint8_t IME;
 uint8_t IF;
 uint8_t IE;
 
-static uint8_t ime_delay;
+uint8_t ime_delay;
+uint8_t interrupt_pending;
 
 bool interrupt_flush(void)
 {
-	if(ime_delay >= 2)
-	{
-		ime_delay = 1;
-		return 0;
-	}
-	if (ime_delay == 1) {
-		IME = 1;
-		ime_delay = 0;
+	if (CpuPolicy::ei_delay) {
+		if(ime_delay >= 2)
+		{
+			ime_delay = 1;
+			return 0;
+		}
+		if (ime_delay == 1) {
+			IME = 1;
+			ime_delay = 0;
+			interrupt_update();
+		}
 	}
 
 	/* Returns true if the cpu should be unhalted */
@@ -28,6 +34,7 @@ bool interrupt_flush(void)
 		if (IE & IF & (1 << i)) {
 			IME = 0;
 			IF &= ~(1 << i);
+			interrupt_update();
 			cpu_interrupt(0x40 + i*0x08);
 			return true;
 		}
@@ -38,15 +45,42 @@ bool interrupt_flush(void)
 
 void interrupt_enable(void)
 {
-	ime_delay = 2;
+	/* Without the delay an interrupt that is already pending is taken
+	 * before the instruction after EI */
+	if (CpuPolicy::ei_delay)
+		ime_delay = 2;
+	else
+		IME = 1;
+	interrupt_update();
 }
 
 void interrupt(uint8_t n)
 {
 	/* Add this interrupt to pending queue */
 	IF |= n;
+	interrupt_update();
 
 	/* Interrupt requested, unhalt CPU if IF and IE have a match */
 	if(IF & IE & 0x1F)
 		halted = 0;
 }
+
+static uint8_t interrupt_read_if(uint16_t)
+{
+	/* With M-cycle timing a read lands mid-instruction, possibly past
+	 * the event that raises the flag */
+	if (CpuPolicy::mcycle_timing)
+		gb_sync();
+	return IF;
+}
+
+static void interrupt_write_if(uint16_t, uint8_t v)
+{
+	IF = v;
+	interrupt_update();
+}
+
+void interrupt_init(void)
+{
+	mem_io_handler(0xFF0F, interrupt_read_if, interrupt_write_if);
+}
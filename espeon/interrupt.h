@@ -2,15 +2,36 @@
 #define INTERRUPT_H
 
 #include <stdint.h>
+#include "policy.h"
 
 extern uint8_t IME;
 extern uint8_t IF;
 extern uint8_t IE;
+extern uint8_t ime_delay;
 
+/* Set while interrupt_flush() has work to do: an EI waiting to take effect
+ * or an enabled interrupt it could service. The CPU tests this once per
+ * instruction instead of calling interrupt_flush(), so everything that
+ * changes IF, IE, IME or ime_delay has to call interrupt_update(). */
+extern uint8_t interrupt_pending;
+
+/* Claims IF, after mmu_init(). IE lives outside the I/O page. */
+void interrupt_init(void);
 void interrupt(uint8_t);
 void interrupt_enable(void);
 bool interrupt_flush(void);
 
+static inline void interrupt_update(void)
+{
+	interrupt_pending = (CpuPolicy::ei_delay && ime_delay) || (IME && (IF & IE & 0x1F));
+}
+
+/* True when interrupt_flush() would do nothing */
+static inline bool interrupt_quiet(void)
+{
+	return !interrupt_pending;
+}
+
 enum {
 	INTR_VBLANK  = 0x01,
 	INTR_LCDSTAT = 0x02,
@@ -7,6 +7,10 @@
 #include "interrupt.h"
 #include "espeon.h"
 #include "mem.h"
+#include "cpu.h"
+#include "gb.h"
+#include "policy.h"
+#include "sched.h"
 
 #define MODE2_BOUNDS 	(204/4)
 #define MODE3_BOUNDS 	(284/4)
@@ -86,8 +90,12 @@ void lcd_reset(void)
 	lcd_cycles = 0;
 }
 
-uint8_t lcd_get_stat(void)
+static uint8_t lcd_read_stat(uint16_t)
 {
+	/* With M-cycle timing a read lands mid-instruction, possibly past
+	 * the event that ends the batch */
+	if (CpuPolicy::mcycle_timing)
+		gb_sync_lcd();
 	return lcd_stat | (ly_int_flag<<2) | lcd_mode;
 }
 
@@ -108,38 +116,53 @@ static inline void lcd_set_palettes(const LCDC& lcdc)
 	sprpalette2[3] = (n>>6)&3;
 }
 
-void lcd_write_bg_palette(uint8_t n)
+static void lcd_write_bg_palette(uint16_t a, uint8_t n)
 {
+	IO_REG(a) = n;
 	lcdc.bg_palette = n;
 }
 
-void lcd_write_spr_palette1(uint8_t n)
+static void lcd_write_spr_palette1(uint16_t a, uint8_t n)
 {
+	IO_REG(a) = n;
 	lcdc.spr_palette1 = n;
 }
 
-void lcd_write_spr_palette2(uint8_t n)
+static void lcd_write_spr_palette2(uint16_t a, uint8_t n)
 {
+	IO_REG(a) = n;
 	lcdc.spr_palette2 = n;
 }
 
-void lcd_write_scroll_x(uint8_t n)
+static void lcd_write_scroll_x(uint16_t a, uint8_t n)
 {
+	IO_REG(a) = n;
 	lcdc.scroll_x = n;
 }
 
-void lcd_write_scroll_y(uint8_t n)
+static void lcd_write_scroll_y(uint16_t a, uint8_t n)
 {
+	IO_REG(a) = n;
 	lcdc.scroll_y = n;
 }
 
-uint8_t lcd_get_line(void)
+static uint8_t lcd_read_line(uint16_t)
 {
+	if (CpuPolicy::mcycle_timing)
+		gb_sync_lcd();
 	return lcd_line;
 }
 
-void lcd_write_stat(uint8_t c)
+/* LY is read-only */
+static void lcd_write_line(uint16_t, uint8_t)
 {
+}
+
+/* STAT and LYC decide which transitions raise an interrupt, the LCD has
+ * to be up to date before they change */
+static void lcd_write_stat(uint16_t, uint8_t c)
+{
+	gb_sync_lcd();
 	ly_int                = !!(c & 0x40);
 	mode2_oam_int         = !!(c & 0x20);
 	mode1_vblank_int      = !!(c & 0x10);
@@ -148,7 +171,7 @@ void lcd_write_stat(uint8_t c)
 	lcd_stat = (c & 0xF8);
 }
 
-void lcd_write_control(uint8_t c)
+static void lcd_write_control(uint8_t c)
 {
 	lcdc.bg_enabled            = !!(c & 0x01);
 	lcdc.sprites_enabled       = !!(c & 0x02);
@@ -167,20 +190,35 @@ void lcd_write_control(uint8_t c)
 	}
 }
 
-void lcd_set_ly_compare(uint8_t c)
+static void lcd_schedule(void);
+
+/* Catches the LCD up before it changes state, the next event moved */
+static void lcd_write_lcdc(uint16_t a, uint8_t c)
 {
+	gb_sync_lcd();
+	IO_REG(a) = c;
+	lcd_write_control(c);
+	lcd_schedule();
+}
+
+static void lcd_set_ly_compare(uint16_t a, uint8_t c)
+{
+	gb_sync_lcd();
+	IO_REG(a) = c;
 	lcd_ly_compare = c;
 	if(lcdc.lcd_enabled)
 		lcd_match_lyc();
 }
 
-void lcd_set_window_y(uint8_t n)
+static void lcd_set_window_y(uint16_t a, uint8_t n)
 {
+	IO_REG(a) = n;
 	lcdc.window_y = n;
 }
 
-void lcd_set_window_x(uint8_t n)
+static void lcd_set_window_x(uint16_t a, uint8_t n)
 {
+	IO_REG(a) = n;
 	lcdc.window_x = n;
 }
 
@@ -212,14 +250,14 @@ static inline int scan_sprites(struct sprite *s, int line, int size)
 	{
 		int y, offs = i * 4;
 	
-		y = mem[0xFE00 + offs++] - 16;
+		y = mem_oam[offs++] - 16;
 		if(line < y || line >= y + 8+(size*8))
 			continue;
 	
 		s[c].y     = y;
-		s[c].x     = mem[0xFE00 + offs++]-8;
-		s[c].tile  = mem[0xFE00 + offs++];
-		s[c].flags = mem[0xFE00 + offs++];
+		s[c].x     = mem_oam[offs++]-8;
+		s[c].tile  = mem_oam[offs++];
+		s[c].flags = mem_oam[offs++];
 		c++;
 	
 		if(c == 10)
@@ -264,14 +302,14 @@ static void draw_bg_and_window(fbuffer_t *b, int line, struct LCDC& lcdc)
 		 */
 		map_offset = (ym/8)*32 + xm/8;
 
-		tile_num = mem[0x9800 + map_select*0x400 + map_offset];
+		tile_num = mem_vram[0x1800 + map_select*0x400 + map_offset];
 		if(lcdc.bg_tiledata_select)
-			tile_addr = 0x8000 + tile_num*16;
+			tile_addr = tile_num*16;
 		else
-			tile_addr = 0x9000 + ((signed char)tile_num)*16;
+			tile_addr = 0x1000 + ((signed char)tile_num)*16;
 
-		b1 = mem[tile_addr+(ym&7)*2];
-		b2 = mem[tile_addr+(ym&7)*2+1];
+		b1 = mem_vram[tile_addr+(ym&7)*2];
+		b2 = mem_vram[tile_addr+(ym&7)*2+1];
 		mask = 128>>(xm&7);
 		colour = (!!(b2&mask)<<1) | !!(b1&mask);
 		
@@ -293,11 +331,11 @@ static void draw_sprites(fbuffer_t *b, int line, int nsprites, struct sprite *s,
 		sprite_line = s[i].flags & VFLIP ? (lcdc.sprite_size ? 15 : 7)-(line - s[i].y) : line - s[i].y;
 
 		/* Address of the tile data for this sprite line */
-		tile_addr = 0x8000 + (s[i].tile*16) + sprite_line*2;
+		tile_addr = (s[i].tile*16) + sprite_line*2;
 
 		/* The two bytes of data holding the palette entries */
-		b1 = mem[tile_addr];
-		b2 = mem[tile_addr+1];
+		b1 = mem_vram[tile_addr];
+		b2 = mem_vram[tile_addr+1];
 
 		/* For each pixel in the line, draw it */
 		offset = s[i].x + line * 160;
@@ -388,7 +426,7 @@ void lcd_cycle(uint32_t cycles)
 			lcd_line = 0;
 		}
 		// Update LY register directly in memory (not through mem_write_byte to avoid reset)
-		mem[0xFF44] = lcd_line;
+		IO_REG(0xFF44) = lcd_line;
 		lcd_match_lyc();
 		
 		// Update mode based on current line
@@ -456,11 +494,37 @@ void lcd_cycle(uint32_t cycles)
 			}
 		}
 	}
-	
-	// Update STAT register to reflect current LCD mode
-	uint8_t stat = mem_get_byte(0xFF41);
-	stat = (stat & 0xFC) | (lcd_mode & 0x03);
-	mem_write_byte(0xFF41, stat);
+}
+
+/* Cycles until lcd_cycle() next changes state: a mode change within the
+ * scanline or the start of the next line. A mode that doesn't match the
+ * current position yet (e.g. right after the LCD is switched on) is fixed
+ * up on the very next call. */
+static uint32_t lcd_cycles_until_event(void)
+{
+	if(!lcdc.lcd_enabled)
+		return 0xFFFFFFFF;
+
+	if(lcd_line < 144) {
+		if(lcd_cycles < MODE2_BOUNDS)
+			return lcd_mode == 2 ? MODE2_BOUNDS - lcd_cycles : 1;
+		if(lcd_cycles < MODE3_BOUNDS)
+			return lcd_mode == 3 ? MODE3_BOUNDS - lcd_cycles : 1;
+		if(lcd_mode != 0)
+			return 1;
+	}
+
+	return SCANLINE_CYCLES - lcd_cycles;
+}
+
+/* SCHED_LCD, also rescheduled when LCDC changes */
+static void lcd_schedule(void)
+{
+	gb_sync_lcd();
+	if(lcdc.lcd_enabled)
+		sched_in(SCHED_LCD, lcd_cycles_until_event());
+	else
+		sched_cancel(SCHED_LCD);
 }
 
 bool lcd_init()
@@ -473,8 +537,21 @@ bool lcd_init()
 	}
 	Serial.println("LCD: Queue created successfully");
 	
+	sched_handler_set(SCHED_LCD, lcd_schedule);
+	mem_io_handler(0xFF40, nullptr, lcd_write_lcdc);
+	mem_io_handler(0xFF41, lcd_read_stat, lcd_write_stat);
+	mem_io_handler(0xFF42, nullptr, lcd_write_scroll_y);
+	mem_io_handler(0xFF43, nullptr, lcd_write_scroll_x);
+	mem_io_handler(0xFF44, lcd_read_line, lcd_write_line);
+	mem_io_handler(0xFF45, nullptr, lcd_set_ly_compare);
+	mem_io_handler(0xFF47, nullptr, lcd_write_bg_palette);
+	mem_io_handler(0xFF48, nullptr, lcd_write_spr_palette1);
+	mem_io_handler(0xFF49, nullptr, lcd_write_spr_palette2);
+	mem_io_handler(0xFF4A, nullptr, lcd_set_window_y);
+	mem_io_handler(0xFF4B, nullptr, lcd_set_window_x);
+
 	Serial.println("LCD: Writing control register");
-	lcd_write_control(mem[0xFF40]);
+	lcd_write_control(IO_REG(0xFF40));
 	Serial.println("LCD: Control register written");
 	
 	// Initialize LCD state
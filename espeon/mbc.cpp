@@ -1,4 +1,5 @@
 #include "mbc.h"
+#include "mem.h"
 #include "rom.h"
 #include "espeon.h"
 #include <esp_heap_caps.h>
@@ -7,11 +8,19 @@
 	const uint8_t* new_bank = espeon_get_rom_bank((n) & (rom_banks - 1)); \
 	if (new_bank) { \
 		rombank = new_bank; \
+		mem_map_rom_bank(rombank, (n) & (rom_banks - 1)); \
 	} else { \
 		Serial.printf("ERROR: Failed to load ROM bank %d, keeping previous bank\n", (n) & (rom_banks - 1)); \
 	} \
 } while(0)
-#define SET_RAM_BANK(n)		(rambank = &ram[((n) & (ram_banks - 1)) * 0x2000])
+#define SET_RAM_BANK(n)		do { \
+	rambank = &ram[((n) & (ram_banks - 1)) * 0x2000]; \
+	mem_map_ram_bank(rambank, ram_enabled); \
+} while(0)
+#define SET_RAM_ENABLE(i)	do { \
+	ram_enabled = (((i) & 0x0F) == 0x0A); \
+	mem_map_ram_bank(rambank, ram_enabled); \
+} while(0)
 
 static uint32_t curr_rom_bank = 1;
 static uint8_t rom_banks;
@@ -21,8 +30,8 @@ static bool ram_select;
 static bool ram_enabled;
 static const uint8_t *rom;
 static uint8_t *ram;
-const uint8_t *rombank;
-uint8_t *rambank;
+static const uint8_t *rombank;
+static uint8_t *rambank;
 static const s_rominfo *rominfo;
 
 MBCReader mbc_read_ram;
@@ -117,6 +126,7 @@ bool mbc_init()
 				Serial.println("CRITICAL: MBC: Even ROM bank 0 is unavailable");
 				return false;
 			}
+			mem_map_rom_bank(rombank, 0);
 		}
 	}
 	Serial.println("MBC: ROM bank 1 set successfully");
@@ -158,7 +168,7 @@ uint8_t* mbc_get_ram()
 void MBC3_write_ROM(uint16_t d, uint8_t i)
 {
 	if(d < 0x2000)
-		ram_enabled = ((i & 0x0F) == 0x0A);
+		SET_RAM_ENABLE(i);
 	
 	else if(d < 0x4000) {
 		uint8_t old_bank = curr_rom_bank;
@@ -199,7 +209,7 @@ uint8_t MBC3_read_RAM(uint16_t i)
 void MBC1_write_ROM(uint16_t d, uint8_t i)
 {
 	if(d < 0x2000)
-		ram_enabled = ((i & 0x0F) == 0x0A);
+		SET_RAM_ENABLE(i);
 	
 	else if(d < 0x4000) {
 		uint8_t old_bank = curr_rom_bank;
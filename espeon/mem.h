@@ -4,12 +4,131 @@
 #include <stdint.h>
 
 extern bool usebootrom;
-extern uint8_t* mem;
+
+/* Emulated memory. Each region is allocated on its own by mmu_init(), so
+ * nothing needs a large contiguous block; ROM and cartridge RAM belong to
+ * the ROM loader and the MBC. Offsets are from the start of the region. */
+extern uint8_t* mem_vram;	/* 0x8000-0x9FFF */
+extern uint8_t* mem_wram;	/* 0xC000-0xDFFF, echoed at 0xE000-0xFDFF */
+extern uint8_t* mem_oam;	/* 0xFE00-0xFEFF, sprites and the unused tail */
+extern uint8_t* mem_io;		/* 0xFF00-0xFF7F */
+extern uint8_t* mem_hram;	/* 0xFF80-0xFFFE */
+
+/* I/O register at address a, for the peripherals that keep their state
+ * in it (timer counters, LY) */
+#define IO_REG(a)	mem_io[(a) & 0x7F]
+
+/* Page table, one host pointer per 256-byte page. Plain memory (ROM,
+ * VRAM, WRAM, OAM, enabled cartridge RAM) is accessed straight through it,
+ * a NULL entry sends the access to the slow handlers (I/O, MBC registers,
+ * disabled cartridge RAM, reads during OAM DMA). VRAM is only mapped for
+ * reads, writes go through mem_write_vram() (unless MEM_VRAM_DIRTY is 0). */
+extern const uint8_t* mem_read_map[256];
+extern uint8_t* mem_write_map[256];
 
 bool mmu_init(const uint8_t* bootrom = nullptr);
-uint8_t mem_get_byte(uint16_t);
+/* Reads the page table doesn't map. Swapped for a handler that models
+ * the bus conflicts while an OAM DMA runs, so nothing else tests for it. */
+extern uint8_t (*mem_get_byte_slow)(uint16_t);
+void mem_write_byte_slow(uint16_t, uint8_t);
+
+/* I/O page, 0xFF00-0xFF7F: one read and one write handler per register,
+ * called with the address. Reads are ORed with the register's unused
+ * bits, which read back as 1. mmu_init() resets every register to plain
+ * storage in mem_io and the peripherals claim theirs from their init;
+ * nullptr keeps the plain handler for that side. */
+typedef uint8_t (*mem_io_reader)(uint16_t);
+typedef void (*mem_io_writer)(uint16_t, uint8_t);
+void mem_io_handler(uint16_t, mem_io_reader, mem_io_writer);
+uint8_t mem_io_read_plain(uint16_t);
+void mem_io_write_plain(uint16_t, uint8_t);
+
+/* OAM DMA with CpuPolicy::dma_conflicts, from the FF46 write until its
+ * SCHED_DMA event puts the normal read path back */
+bool mem_dma_active(void);
+
+/* Number of the ROM bank mapped at 0x4000 */
+extern uint16_t mem_rom_bank;
+
+/* Link port: when set, gets every byte the game sends over serial. The
+ * host test ROM runner reads Blargg and Mooneye results from it. */
+extern void (*mem_serial_out)(uint8_t);
+
+/* Called by the MBC when the banks mapped at 0x4000 and 0xA000 change */
+void mem_map_rom_bank(const uint8_t* bank, uint16_t number);
+void mem_map_ram_bank(uint8_t* bank, bool enabled);
+
+/* Build with -DMEM_VRAM_DIRTY=0 to map VRAM writes straight through the
+ * page table and leave the bitmaps below empty, to measure what the
+ * tracking costs (host bench_novramdirty) */
+#ifndef MEM_VRAM_DIRTY
+#define MEM_VRAM_DIRTY 1
+#endif
+
+/* What changed in VRAM since the renderer last looked: one bit per
+ * 16-byte tile at 0x8000-0x97FF and one per tile map entry, the 0x9800
+ * map first. A tile map row is one word. Writes that don't change the
+ * byte don't count. */
+struct vram_dirty {
+	uint32_t tiles[384 / 32];
+	uint32_t map[2048 / 32];
+};
+extern struct vram_dirty mem_vram_dirty;
+
+/* Hands the bits gathered since the last call to out and clears them,
+ * false if nothing was written. For a renderer working per frame. */
+bool mem_vram_consume(struct vram_dirty* out);
+
+/* Clears and returns the dirty bits of one tile map row (0-31) of map 0
+ * (0x9800) or 1 (0x9C00), for a renderer working per line */
+static inline uint32_t mem_vram_consume_map_row(int map, int row)
+{
+	uint32_t bits = mem_vram_dirty.map[map * 32 + row];
+	mem_vram_dirty.map[map * 32 + row] = 0;
+	return bits;
+}
+
+static inline bool mem_vram_tile_dirty(const struct vram_dirty* d, int tile)
+{
+	return d->tiles[tile >> 5] & (1u << (tile & 31));
+}
+
+static inline void mem_write_vram(uint16_t d, uint8_t i)
+{
+	uint16_t o = d - 0x8000;
+	if (!MEM_VRAM_DIRTY) {
+		mem_vram[o] = i;
+		return;
+	}
+	if (mem_vram[o] == i)
+		return;
+	mem_vram[o] = i;
+	if (o < 0x1800)
+		mem_vram_dirty.tiles[o >> 9] |= 1u << ((o >> 4) & 31);
+	else
+		mem_vram_dirty.map[(o - 0x1800) >> 5] |= 1u << (o & 31);
+}
+
+inline uint8_t mem_get_byte(uint16_t i)
+{
+	const uint8_t* page = mem_read_map[i >> 8];
+	if (page)
+		return page[i & 0xFF];
+	return mem_get_byte_slow(i);
+}
+
+inline void mem_write_byte(uint16_t d, uint8_t i)
+{
+	uint8_t* page = mem_write_map[d >> 8];
+	if (page)
+		page[d & 0xFF] = i;
+	else if ((d & 0xE000) == 0x8000)
+		mem_write_vram(d, i);
+	else
+		mem_write_byte_slow(d, i);
+}
+
 inline uint16_t mem_get_word(uint16_t i) { return mem_get_byte(i) | (mem_get_byte(i+1)<<8); }
-void mem_write_byte(uint16_t, uint8_t);
 inline void mem_write_word(uint16_t d, uint16_t i) { mem_write_byte(d, i&0xFF); mem_write_byte(d+1, i>>8); }
 
 #endif
@@ -0,0 +1,41 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+/* Accuracy policies. The CPU core (Core<P> in cpu.cpp) and the parts of
+ * mem and interrupt it leans on are specialised at compile time by one of
+ * these; a feature that is off costs nothing, the code for it is folded
+ * away rather than tested at run time.
+ *   halt_bug:      HALT with IME=0 and an interrupt pending reads the next
+ *                  opcode twice
+ *   ei_delay:      EI takes effect after the following instruction
+ *   mcycle_timing: memory accesses happen on their own M-cycle within the
+ *                  instruction rather than all on its first one
+ *   dma_conflicts: reads outside HRAM return the byte OAM DMA is copying
+ *
+ * The device runs FastPolicy. Build with -DCPU_ACCURATE=1 for the host
+ * regression runs and test ROMs. */
+struct FastPolicy {
+	static constexpr bool halt_bug = false;
+	static constexpr bool ei_delay = false;
+	static constexpr bool mcycle_timing = false;
+	static constexpr bool dma_conflicts = false;
+};
+
+struct AccuratePolicy {
+	static constexpr bool halt_bug = true;
+	static constexpr bool ei_delay = true;
+	static constexpr bool mcycle_timing = true;
+	static constexpr bool dma_conflicts = true;
+};
+
+#ifndef CPU_ACCURATE
+#define CPU_ACCURATE 0
+#endif
+
+#if CPU_ACCURATE
+typedef AccuratePolicy CpuPolicy;
+#else
+typedef FastPolicy CpuPolicy;
+#endif
+
+#endif
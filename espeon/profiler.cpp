@@ -0,0 +1,173 @@
+#include "profiler.h"
+
+#if CPU_PROFILER
+
+#include <stdio.h>
+#include <string.h>
+#include "mem.h"
+#include "espeon.h"
+
+#define TOP_MAX	32
+
+struct counter {
+	uint32_t count;
+	uint64_t cycles;
+};
+
+/* Hotspots are keyed by bank << 16 | PC, bank is 0 outside 0x4000-0x7FFF */
+struct hotspot {
+	uint32_t key;
+	struct counter n;
+};
+
+static struct counter ops[256];
+static struct counter cb_ops[256];
+static struct hotspot spots[PROFILER_HOTSPOTS];
+static uint32_t spots_dropped;
+static uint64_t total_cycles;
+
+/* The instruction being executed, its cycles are known once it ends */
+static struct counter* cur_op;
+static struct counter* cur_cb;
+static struct counter* cur_spot;
+static uint32_t cur_start;
+static uint32_t frames;
+
+static struct counter* hotspot(uint32_t key)
+{
+	uint32_t h = (key * 2654435761u) >> 16;
+	for (int probe = 0; probe < 8; probe++) {
+		struct hotspot* s = &spots[(h + probe) & (PROFILER_HOTSPOTS - 1)];
+		if (s->key == key && s->n.count)
+			return &s->n;
+		if (!s->n.count) {
+			s->key = key;
+			return &s->n;
+		}
+	}
+	spots_dropped++;
+	return NULL;
+}
+
+void profiler_instruction(uint32_t end, uint32_t start, uint8_t op, uint8_t cb, uint16_t pc)
+{
+	if (cur_op) {
+		uint32_t d = end - cur_start;
+		cur_op->cycles += d;
+		if (cur_cb)
+			cur_cb->cycles += d;
+		if (cur_spot)
+			cur_spot->cycles += d;
+		total_cycles += d;
+	}
+
+	uint16_t bank = (pc >= 0x4000 && pc < 0x8000) ? mem_rom_bank : 0;
+	cur_op = &ops[op];
+	cur_cb = op == 0xCB ? &cb_ops[cb] : NULL;
+	cur_spot = hotspot((uint32_t)bank << 16 | pc);
+	cur_op->count++;
+	if (cur_cb)
+		cur_cb->count++;
+	if (cur_spot)
+		cur_spot->count++;
+	cur_start = start;
+}
+
+void profiler_reset(void)
+{
+	memset(ops, 0, sizeof(ops));
+	memset(cb_ops, 0, sizeof(cb_ops));
+	memset(spots, 0, sizeof(spots));
+	spots_dropped = 0;
+	total_cycles = 0;
+	cur_op = cur_cb = cur_spot = NULL;
+}
+
+/* Indices of the n entries with the most cycles, best first */
+static int top_n(const struct counter* (*get)(int), int size, int* best, int n)
+{
+	int found = 0;
+	for (int i = 0; i < size; i++) {
+		const struct counter* e = get(i);
+		if (!e->count)
+			continue;
+		if (found == n && get(best[n-1])->cycles >= e->cycles)
+			continue;
+		int j = found < n ? found++ : n - 1;
+		while (j > 0 && get(best[j-1])->cycles < e->cycles) {
+			best[j] = best[j-1];
+			j--;
+		}
+		best[j] = i;
+	}
+	return found;
+}
+
+static const struct counter* get_op(int i) { return &ops[i]; }
+static const struct counter* get_cb(int i) { return &cb_ops[i]; }
+static const struct counter* get_spot(int i) { return &spots[i].n; }
+
+enum { TABLE_OPS, TABLE_CB, TABLE_SPOTS };
+
+static void dump_table(int table, int n)
+{
+	static const char* const titles[] = { "opcodes", "CB opcodes", "bank:PC" };
+	const struct counter* (* const get)(int) =
+		table == TABLE_OPS ? get_op : table == TABLE_CB ? get_cb : get_spot;
+	int best[TOP_MAX];
+	int found = top_n(get, table == TABLE_SPOTS ? PROFILER_HOTSPOTS : 256, best, n);
+	double total = total_cycles ? (double)total_cycles : 1.0;
+
+	Serial.printf("PROFILE: top %s\n", titles[table]);
+	for (int i = 0; i < found; i++) {
+		const struct counter* e = get(best[i]);
+		if (table == TABLE_SPOTS)
+			Serial.printf("  %02X:%04X", spots[best[i]].key >> 16, spots[best[i]].key & 0xFFFF);
+		else
+			Serial.printf("  %s%02X", table == TABLE_CB ? "CB " : "", best[i]);
+		Serial.printf("  %10u runs  %12llu cycles  %5.2f%%\n", e->count,
+		              (unsigned long long)e->cycles, e->cycles * 100.0 / total);
+	}
+}
+
+void profiler_dump(int n)
+{
+	if (n > TOP_MAX)
+		n = TOP_MAX;
+	Serial.printf("PROFILE: %llu M-cycles profiled\n", (unsigned long long)total_cycles);
+	dump_table(TABLE_OPS, n);
+	dump_table(TABLE_CB, n);
+	dump_table(TABLE_SPOTS, n);
+	if (spots_dropped)
+		Serial.printf("PROFILE: %u instructions missed the hotspot table\n", spots_dropped);
+}
+
+void profiler_frame(void)
+{
+	if (++frames % PROFILER_DUMP_FRAMES == 0)
+		profiler_dump(16);
+}
+
+#if defined(__linux__)
+/* One row per opcode, CB opcode and hotspot: kind,bank,pc_or_op,count,cycles */
+bool profiler_write_csv(const char* path)
+{
+	FILE* f = fopen(path, "w");
+	if (!f)
+		return false;
+	fprintf(f, "kind,bank,key,count,cycles\n");
+	for (int i = 0; i < 256; i++)
+		if (ops[i].count)
+			fprintf(f, "op,,%02X,%u,%llu\n", i, ops[i].count, (unsigned long long)ops[i].cycles);
+	for (int i = 0; i < 256; i++)
+		if (cb_ops[i].count)
+			fprintf(f, "cb,,%02X,%u,%llu\n", i, cb_ops[i].count, (unsigned long long)cb_ops[i].cycles);
+	for (int i = 0; i < PROFILER_HOTSPOTS; i++)
+		if (spots[i].n.count)
+			fprintf(f, "pc,%02X,%04X,%u,%llu\n", spots[i].key >> 16, spots[i].key & 0xFFFF,
+			        spots[i].n.count, (unsigned long long)spots[i].n.cycles);
+	return fclose(f) == 0;
+}
+#endif
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+/* Build with -DCPU_PROFILER=1 to count executions and M-cycles per
+ * opcode, per CB opcode and per (ROM bank, PC). The counts are emulated
+ * cycles, so the profiler's own overhead doesn't skew them. On the device
+ * profiler_frame() prints the top entries every PROFILER_DUMP_FRAMES
+ * frames; host/profile runs a ROM and writes the whole table as CSV. */
+#ifndef CPU_PROFILER
+#define CPU_PROFILER 0
+#endif
+
+/* (bank, PC) slots, power of two, 24 bytes each */
+#ifndef PROFILER_HOTSPOTS
+#define PROFILER_HOTSPOTS	1024
+#endif
+#define PROFILER_DUMP_FRAMES	3600
+
+#if CPU_PROFILER
+/* Called by the CPU core as each instruction starts: end is the cycle the
+ * previous one finished on, start the cycle this one begins on (they
+ * differ by an interrupt dispatch) and pc its address */
+void profiler_instruction(uint32_t end, uint32_t start, uint8_t op, uint8_t cb, uint16_t pc);
+void profiler_reset(void);
+/* Top n opcodes, CB opcodes and hotspots by cycles, over Serial */
+void profiler_dump(int n);
+void profiler_frame(void);
+#if defined(__linux__)
+bool profiler_write_csv(const char* path);
+#endif
+#else
+static inline void profiler_dump(int) {}
+static inline void profiler_frame(void) {}
+#endif
+
+#endif
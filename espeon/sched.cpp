@@ -0,0 +1,109 @@
+#include "sched.h"
+#include "cpu.h"
+
+struct event {
+	uint64_t when;
+	sched_handler handler;
+};
+
+static struct event events[SCHED_EVENTS];
+/* Every event is always in the heap, the ones not pending at SCHED_NEVER.
+ * pos[] is an event's index in heap[]. */
+static uint8_t heap[SCHED_EVENTS];
+static uint8_t pos[SCHED_EVENTS];
+
+static uint64_t now;
+static uint32_t last_cpu_cycles;
+
+static inline uint64_t when_at(int i)
+{
+	return events[heap[i]].when;
+}
+
+static inline void heap_swap(int i, int j)
+{
+	uint8_t e = heap[i];
+	heap[i] = heap[j];
+	heap[j] = e;
+	pos[heap[i]] = i;
+	pos[heap[j]] = j;
+}
+
+static void sift(int i)
+{
+	while (i > 0 && when_at(i) < when_at((i - 1) / 2)) {
+		heap_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+	for (;;) {
+		int l = 2 * i + 1, r = l + 1, m = i;
+		if (l < SCHED_EVENTS && when_at(l) < when_at(m))
+			m = l;
+		if (r < SCHED_EVENTS && when_at(r) < when_at(m))
+			m = r;
+		if (m == i)
+			break;
+		heap_swap(i, m);
+		i = m;
+	}
+}
+
+void sched_init(void)
+{
+	for (int e = 0; e < SCHED_EVENTS; e++) {
+		events[e].when = SCHED_NEVER;
+		heap[e] = e;
+		pos[e] = e;
+	}
+	now = 0;
+	last_cpu_cycles = cpu_get_cycles();
+}
+
+void sched_handler_set(int event, sched_handler handler)
+{
+	events[event].handler = handler;
+}
+
+/* The CPU counter is 32 bits and wraps after about an hour of emulated
+ * time, this is called often enough to never miss a wrap */
+uint64_t sched_now(void)
+{
+	uint32_t cycles = cpu_get_cycles();
+	now += (uint32_t)(cycles - last_cpu_cycles);
+	last_cpu_cycles = cycles;
+	return now;
+}
+
+void sched_at(int event, uint64_t when)
+{
+	if (when < when_at(0))
+		cpu_break();
+	events[event].when = when;
+	sift(pos[event]);
+}
+
+void sched_in(int event, uint32_t cycles)
+{
+	sched_at(event, sched_now() + cycles);
+}
+
+void sched_cancel(int event)
+{
+	sched_at(event, SCHED_NEVER);
+}
+
+uint64_t sched_next(void)
+{
+	return when_at(0);
+}
+
+void sched_dispatch(void)
+{
+	uint64_t t = sched_now();
+	while (when_at(0) <= t) {
+		int e = heap[0];
+		sched_cancel(e);
+		if (events[e].handler)
+			events[e].handler();
+	}
+}
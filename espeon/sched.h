@@ -0,0 +1,44 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+/* Peripheral events on a 64-bit M-cycle timebase. Each peripheral keeps
+ * one pending event, the time of its next state change, and gb_run() runs
+ * the CPU up to the earliest of them, so nothing is looked at between
+ * events. The events live in a binary heap keyed on their time. */
+enum {
+	SCHED_LCD,	/* mode change or next line */
+	SCHED_TIMER,	/* TIMA overflow */
+	SCHED_DMA,	/* end of OAM DMA */
+	SCHED_SERIAL,	/* end of a serial transfer */
+	SCHED_INPUT,	/* next joypad poll */
+	SCHED_EVENTS
+};
+
+#define SCHED_NEVER	UINT64_MAX
+
+/* Called once the event's time has been reached, possibly a few cycles
+ * late (an instruction isn't interrupted). The event is cancelled first,
+ * a periodic handler schedules the next one itself. */
+typedef void (*sched_handler)(void);
+
+/* Cancels every event and restarts the timebase at 0, handlers stay */
+void sched_init(void);
+void sched_handler_set(int event, sched_handler handler);
+
+/* M-cycles since sched_init(), follows cpu_get_cycles() */
+uint64_t sched_now(void);
+
+/* (Re)schedules an event. One that becomes the earliest ends the current
+ * cpu_run() batch after the instruction being executed. */
+void sched_at(int event, uint64_t when);
+void sched_in(int event, uint32_t cycles);
+void sched_cancel(int event);
+
+/* Time of the earliest event, SCHED_NEVER if none is pending */
+uint64_t sched_next(void);
+/* Runs the handlers of every event that is due, earliest first */
+void sched_dispatch(void);
+
+#endif
@@ -0,0 +1,67 @@
+#include "supervisor.h"
+
+#ifdef USE_SUPERVISOR
+
+#include "cpu.h"
+#include "mem.h"
+#include "espeon.h"
+#include "trace.h"
+
+#define PC_HISTORY		10
+#define STUCK_WINDOW		8	/* bytes */
+#define STUCK_TIMEOUT_MS	5000
+#define STATUS_INTERVAL		300	/* frames */
+
+static uint16_t pc_history[PC_HISTORY];
+static uint8_t pc_history_index;
+static uint32_t frame_count;
+static uint32_t stuck_since;
+static uint16_t stuck_pc;
+static uint32_t rst38_frames;
+
+void supervisor_frame(void)
+{
+	uint16_t pc = cpu_get_pc();
+	uint32_t now = millis();
+
+	frame_count++;
+	pc_history[pc_history_index] = pc;
+	pc_history_index = (pc_history_index + 1) % PC_HISTORY;
+
+	/* Stuck in a tight area across the last PC_HISTORY frames? */
+	uint16_t pc_min = 0xFFFF, pc_max = 0;
+	for (int i = 0; i < PC_HISTORY; i++) {
+		if (pc_history[i] < pc_min) pc_min = pc_history[i];
+		if (pc_history[i] > pc_max) pc_max = pc_history[i];
+	}
+
+	if (pc_max - pc_min <= STUCK_WINDOW) {
+		if (stuck_pc != pc_min) {
+			stuck_since = now;
+			stuck_pc = pc_min;
+		} else if (now - stuck_since > STUCK_TIMEOUT_MS) {
+			Serial.printf("SUPERVISOR: PC stuck around 0x%04X for %u ms\n",
+			              pc_min, now - stuck_since);
+			trace_dump();
+			stuck_since = now;
+		}
+	} else {
+		stuck_pc = 0;
+	}
+
+	/* Executing 0xFF fill at the RST 38 vector recurses forever */
+	if (pc == 0x0038 && mem_get_byte(0x0038) == 0xFF) {
+		if (++rst38_frames % 60 == 1) {
+			Serial.printf("WARNING: RST 38 loop detected (%d frames), Memory at 0x0038: 0x%02X\n",
+			              rst38_frames, mem_get_byte(0x0038));
+			if (rst38_frames == 1)
+				trace_dump();
+		}
+	}
+
+	if (frame_count % STATUS_INTERVAL == 0)
+		Serial.printf("CPU_DEBUG: Frame %d, PC=0x%04X, total cycles=%u\n",
+		              frame_count, pc, cpu_get_cycles());
+}
+
+#endif
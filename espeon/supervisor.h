@@ -0,0 +1,15 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+/* Uncomment (or build with -DUSE_SUPERVISOR) to enable hang reports and
+ * periodic CPU diagnostics. It samples the CPU once per frame, so it
+ * adds nothing to the instruction path either way. */
+// #define USE_SUPERVISOR
+
+#ifdef USE_SUPERVISOR
+void supervisor_frame(void);
+#else
+static inline void supervisor_frame(void) {}
+#endif
+
+#endif
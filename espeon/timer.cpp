@@ -2,6 +2,8 @@
 #include "timer.h"
 #include "interrupt.h"
 #include "mem.h"
+#include "gb.h"
+#include "sched.h"
 
 #define DIV  0xFF04
 #define TIMA 0xFF05
@@ -13,22 +15,51 @@ static uint8_t started;
 static uint32_t speed = 1024;
 static uint16_t divider;
 
-void timer_reset_div(void)
+static void timer_set_tac(uint8_t v)
 {
-	divider = 0;
+	const int speeds[] = {1024, 16, 64, 256};
+	IO_REG(TAC) = v;
+	started = v&4;
+	speed = speeds[v&3];
+	/* A faster clock would leave more than a period banked */
+	ticks %= speed;
 }
 
-uint8_t timer_get_div(void)
+/* The timer runs in batches, catch it up before touching its state */
+static uint8_t timer_read_div(uint16_t)
 {
+	gb_sync_timer();
 	return (divider >> 8);
 }
 
-void timer_set_tac(uint8_t v)
+static void timer_write_div(uint16_t, uint8_t)
 {
-	const int speeds[] = {1024, 16, 64, 256};
-	mem[TAC] = v;
-	started = v&4;
-	speed = speeds[v&3];
+	gb_sync_timer();
+	divider = 0;
+}
+
+/* Only overflows are scheduled, TIMA counts between events */
+static uint8_t timer_read_counter(uint16_t)
+{
+	gb_sync_timer();
+	return IO_REG(TIMA);
+}
+
+static void timer_schedule(void);
+
+/* Both move the next overflow */
+static void timer_write_counter(uint16_t, uint8_t v)
+{
+	gb_sync_timer();
+	IO_REG(TIMA) = v;
+	timer_schedule();
+}
+
+static void timer_write_tac(uint16_t, uint8_t v)
+{
+	gb_sync_timer();
+	timer_set_tac(v);
+	timer_schedule();
 }
 
 void timer_cycle(uint32_t delta)
@@ -36,14 +67,39 @@ void timer_cycle(uint32_t delta)
 	delta *= 4;
 	divider += delta;
 	if(started) {
+		/* Keep the remainder, catch-ups land anywhere between ticks */
 		ticks += delta;
-		if(ticks >= speed) {
-			//ticks -= speed;
-			ticks = 0;
-			if(++mem[TIMA] >= 0x100) {
+		while(ticks >= speed) {
+			ticks -= speed;
+			if(++IO_REG(TIMA) == 0) {
 				interrupt(INTR_TIMER);
-				mem[TIMA] = mem[TMA];
+				IO_REG(TIMA) = IO_REG(TMA);
 			}
 		}
 	}
 }
+
+/* SCHED_TIMER: the next time timer_cycle() overflows TIMA */
+static void timer_schedule(void)
+{
+	gb_sync_timer();
+	if(started) {
+		int32_t left = (int32_t)((256 - IO_REG(TIMA)) * speed) - (int32_t)ticks;
+		sched_in(SCHED_TIMER, left > 0 ? (left + 3) / 4 : 0);
+	}
+	else
+		sched_cancel(SCHED_TIMER);
+}
+
+/* After mmu_init() and sched_init() */
+void timer_init(void)
+{
+	ticks = 0;
+	divider = 0;
+	timer_set_tac(IO_REG(TAC));
+	sched_handler_set(SCHED_TIMER, timer_schedule);
+	timer_schedule();
+	mem_io_handler(DIV, timer_read_div, timer_write_div);
+	mem_io_handler(TIMA, timer_read_counter, timer_write_counter);
+	mem_io_handler(TAC, nullptr, timer_write_tac);
+}
@@ -3,14 +3,9 @@
 
 #include <stdint.h>
 
-void timer_set_tac(uint8_t);
+/* Claims DIV, TIMA and TAC and schedules the first overflow, after
+ * mmu_init() and sched_init() */
+void timer_init(void);
 void timer_cycle(uint32_t);
-uint8_t timer_get_div(void);
-uint8_t timer_get_counter(void);
-uint8_t timer_get_modulo(void);
-uint8_t timer_get_tac(void);
-void timer_reset_div(void);
-void timer_set_counter(uint8_t);
-void timer_set_modulo(uint8_t);
 
 #endif
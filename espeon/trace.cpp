@@ -0,0 +1,78 @@
+#include "trace.h"
+
+#if CPU_TRACE
+
+#include <stdio.h>
+#include <string.h>
+#include "espeon.h"
+
+static_assert(sizeof(struct trace_record) == 24, "trace_record is read back by host/tracedump");
+static_assert((TRACE_RECORDS & (TRACE_RECORDS - 1)) == 0, "TRACE_RECORDS must be a power of two");
+
+struct trace_record trace_ring[TRACE_RECORDS];
+uint32_t trace_head;
+uint32_t trace_trigger = (uint32_t)TRACE_TRIGGER_PC;
+
+void trace_reset(void)
+{
+	memset(trace_ring, 0, sizeof(trace_ring));
+	trace_head = 0;
+}
+
+void trace_set_trigger(int pc)
+{
+	trace_trigger = (uint32_t)pc;
+}
+
+void trace_triggered(void)
+{
+	Serial.printf("TRACE: trigger PC %04X reached\n", trace_trigger);
+	trace_trigger = (uint32_t)-1;
+	trace_dump();
+}
+
+/* Index of the oldest record and how many there are */
+static uint32_t trace_span(uint32_t* first)
+{
+	uint32_t n = trace_head < TRACE_RECORDS ? trace_head : TRACE_RECORDS;
+	*first = trace_head - n;
+	return n;
+}
+
+/* One "TRACE: <hex>" line per record, the raw bytes, so the decoder can
+ * read a serial log as well as a binary dump */
+void trace_dump(void)
+{
+	uint32_t first;
+	uint32_t n = trace_span(&first);
+
+	Serial.printf("TRACE: begin %u records\n", n);
+	for (uint32_t i = 0; i < n; i++) {
+		const uint8_t* r = (const uint8_t*)&trace_ring[(first + i) & (TRACE_RECORDS - 1)];
+		char line[2 * sizeof(struct trace_record) + 1];
+		for (size_t j = 0; j < sizeof(struct trace_record); j++)
+			sprintf(&line[2 * j], "%02X", r[j]);
+		Serial.printf("TRACE: %s\n", line);
+	}
+	Serial.println("TRACE: end");
+}
+
+#if defined(__linux__)
+/* "GBTRACE" and a NUL, the record count and size as uint32_t, then the
+ * records oldest first */
+bool trace_write(const char* path)
+{
+	FILE* f = fopen(path, "wb");
+	if (!f)
+		return false;
+	uint32_t first;
+	uint32_t header[2] = { trace_span(&first), sizeof(struct trace_record) };
+	fwrite("GBTRACE", 1, 8, f);
+	fwrite(header, sizeof(header), 1, f);
+	for (uint32_t i = 0; i < header[0]; i++)
+		fwrite(&trace_ring[(first + i) & (TRACE_RECORDS - 1)], sizeof(struct trace_record), 1, f);
+	return fclose(f) == 0;
+}
+#endif
+
+#endif
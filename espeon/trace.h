@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Build with -DCPU_TRACE=1 to keep the last TRACE_RECORDS instructions in
+ * a ring of packed records: PC, ROM bank, opcode, registers and cycle
+ * stamp. Recording is a handful of stores per instruction and nothing is
+ * formatted until the ring is dumped, which happens on trace_dump(), from
+ * espeon_faint(), when the supervisor sees a hang, or when the CPU reaches
+ * the trigger PC. host/tracedump disassembles a dump. */
+#ifndef CPU_TRACE
+#define CPU_TRACE 0
+#endif
+
+/* Records kept, power of two, 24 bytes each */
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS	256
+#endif
+
+/* Dump the ring the first time this PC is reached, -1 for never */
+#ifndef TRACE_TRIGGER_PC
+#define TRACE_TRIGGER_PC	-1
+#endif
+
+/* trace_record.flags */
+enum {
+	TRACE_INTERRUPT = 0x01	/* an interrupt was dispatched just before */
+};
+
+/* One instruction as it was about to run. Little endian, this is also the
+ * layout of the binary dump. */
+struct trace_record {
+	uint32_t cycles;
+	uint16_t pc;
+	uint16_t bank;	/* ROM bank mapped at 0x4000 */
+	uint16_t sp;
+	uint16_t imm;	/* the bytes following the opcode */
+	uint16_t hl, de, bc;
+	uint8_t a, f;
+	uint8_t op;
+	uint8_t flags;
+	uint8_t ie, if_;
+};
+
+#if CPU_TRACE
+extern struct trace_record trace_ring[TRACE_RECORDS];
+extern uint32_t trace_head;
+extern uint32_t trace_trigger;
+
+/* Slot for the next record, overwrites the oldest */
+static inline struct trace_record* trace_next(void)
+{
+	return &trace_ring[trace_head++ & (TRACE_RECORDS - 1)];
+}
+
+void trace_reset(void);
+/* Arms the one-shot trigger, -1 disarms it */
+void trace_set_trigger(int pc);
+/* Called by the CPU core when the trigger PC is reached */
+void trace_triggered(void);
+/* Records oldest first as hex lines over Serial */
+void trace_dump(void);
+#if defined(__linux__)
+bool trace_write(const char* path);
+#endif
+#else
+static inline void trace_dump(void) {}
+#endif
+
+#endif
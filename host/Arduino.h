@@ -0,0 +1,73 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/*
+ * Minimal Arduino core replacement so the emulator core (cpu, mem, mbc,
+ * timer, interrupt, rom, lcd) can be compiled and run on a Linux host.
+ * Only what the core actually touches is provided.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+#ifndef DRAM_ATTR
+#define DRAM_ATTR
+#endif
+
+class String {
+public:
+	String() {}
+	String(const char* s) : s_(s ? s : "") {}
+	String(const std::string& s) : s_(s) {}
+	const char* c_str() const { return s_.c_str(); }
+	size_t length() const { return s_.length(); }
+	bool endsWith(const char* suffix) const {
+		size_t n = strlen(suffix);
+		return s_.length() >= n && s_.compare(s_.length() - n, n, suffix) == 0;
+	}
+	int lastIndexOf(char ch) const {
+		size_t p = s_.rfind(ch);
+		return p == std::string::npos ? -1 : (int)p;
+	}
+	String substring(size_t from) const { return String(s_.substr(from)); }
+	String operator+(const String& o) const { return String(s_ + o.s_); }
+	friend String operator+(const char* a, const String& b) { return String(std::string(a) + b.s_); }
+private:
+	std::string s_;
+};
+
+class HardwareSerial {
+public:
+	void begin(unsigned long) {}
+	int printf(const char* fmt, ...);
+	size_t print(const char* s);
+	size_t println(const char* s = "");
+	size_t println(const String& s) { return println(s.c_str()); }
+	/* Silences all output, used by the benchmark so logging isn't timed */
+	bool quiet = false;
+};
+
+class EspClass {
+public:
+	uint32_t getFreeHeap() { return 256 * 1024; }
+	uint32_t getMinFreeHeap() { return 256 * 1024; }
+	uint32_t getHeapSize() { return 320 * 1024; }
+	void restart() { exit(1); }
+};
+
+extern HardwareSerial Serial;
+extern EspClass ESP;
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void yield(void);
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * CPU core microbenchmark for the Linux host build.
+ *
+ *   bench [mix|alu|copy|tiles|rom.gb] [seconds]
+ *
+ * The synthetic workloads run out of a generated cartridge, so only the
+ * interpreter is measured: "mix" (the default) is loads, ALU, (HL)
+ * accesses, CB ops, stack and branches, "alu" is mostly 8-bit arithmetic
+ * and logic with conditional branches on the result, "copy" is a memcpy
+ * style (HL+)/(DE) loop like the ones games use for tile uploads, "tiles"
+ * the same loop with data that changes every pass (VRAM writes that
+ * aren't no-ops, see MEM_VRAM_DIRTY in espeon/mem.h). With a
+ * ROM whole frames are run through host_run_frames() like pairs and
+ * profile do, so LCD rendering and timer stepping are included.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "Arduino.h"
+#include "host.h"
+#include "../espeon/cpu.h"
+
+#define FRAME_CYCLES (154*456/4)
+
+/* Mirrors the default picked in cpu.cpp */
+#if defined(CPU_THREADED_DISPATCH) && !CPU_THREADED_DISPATCH
+#define CORE_NAME "switch"
+#else
+#define CORE_NAME "threaded"
+#endif
+
+#if defined(CPU_LAZY_FLAGS) && !CPU_LAZY_FLAGS
+#define FLAGS_NAME "eager"
+#else
+#define FLAGS_NAME "lazy"
+#endif
+
+#if defined(CPU_ALU_TABLES) && !CPU_ALU_TABLES
+#define TABLES_NAME "off"
+#else
+#define TABLES_NAME "on"
+#endif
+
+#if defined(CPU_BLOCK_CACHE) && !CPU_BLOCK_CACHE
+#define BLOCKS_NAME "off"
+#else
+#define BLOCKS_NAME "on"
+#endif
+
+#if defined(CPU_ACCURATE) && CPU_ACCURATE
+#define POLICY_NAME "accurate"
+#else
+#define POLICY_NAME "fast"
+#endif
+
+#if (defined(CPU_FUSION) && !CPU_FUSION) || (defined(CPU_BLOCK_CACHE) && !CPU_BLOCK_CACHE)
+#define FUSION_NAME "off"
+#else
+#define FUSION_NAME "on"
+#endif
+
+static const uint8_t mix_program[] = {
+	/* 0150 start: */
+	0x31, 0xFF, 0xDF,	/* LD SP, DFFF */
+	0x21, 0x00, 0xC0,	/* LD HL, C000 */
+	0x11, 0x00, 0xC1,	/* LD DE, C100 */
+	0x06, 0x40,		/* LD B, 40 */
+	/* 015B loop: */
+	0x2A,			/* LD A, (HL+) */
+	0x80,			/* ADD A, B */
+	0xA9,			/* XOR C */
+	0x12,			/* LD (DE), A */
+	0x13,			/* INC DE */
+	0xFE, 0x80,		/* CP 80 */
+	0x38, 0x01,		/* JR C, skip */
+	0x0C,			/* INC C */
+	/* 0165 skip: */
+	0xCB, 0x37,		/* SWAP A */
+	0xCB, 0x5F,		/* BIT 3, A */
+	0xF5,			/* PUSH AF */
+	0xCD, 0x74, 0x01,	/* CALL sub */
+	0xF1,			/* POP AF */
+	0x05,			/* DEC B */
+	0x20, 0xEA,		/* JR NZ, loop */
+	0xC3, 0x50, 0x01,	/* JP start */
+	/* 0174 sub: */
+	0xE6, 0x0F,		/* AND 0F */
+	0xB5,			/* OR L */
+	0xC9,			/* RET */
+};
+
+static const uint8_t alu_program[] = {
+	/* 0150 start: */
+	0x31, 0xFF, 0xDF,	/* LD SP, DFFF */
+	0x21, 0x00, 0xC0,	/* LD HL, C000 */
+	0x01, 0x34, 0x12,	/* LD BC, 1234 */
+	0x11, 0x78, 0x56,	/* LD DE, 5678 */
+	/* 015C loop: */
+	0x78,			/* LD A, B */
+	0x81,			/* ADD A, C */
+	0x8A,			/* ADC A, D */
+	0x93,			/* SUB E */
+	0x9C,			/* SBC A, H */
+	0x04,			/* INC B */
+	0x0D,			/* DEC C */
+	0xE6, 0xF7,		/* AND F7 */
+	0xAA,			/* XOR D */
+	0xB3,			/* OR E */
+	0xBD,			/* CP L */
+	0x30, 0x01,		/* JR NC, +1 */
+	0x14,			/* INC D */
+	0x1C,			/* INC E */
+	0x86,			/* ADD A, (HL) */
+	0xFE, 0x80,		/* CP 80 */
+	0x38, 0x01,		/* JR C, +1 */
+	0x1D,			/* DEC E */
+	0x27,			/* DAA */
+	0x57,			/* LD D, A */
+	0x2C,			/* INC L */
+	0x20, 0xE5,		/* JR NZ, loop */
+	0xC3, 0x5C, 0x01,	/* JP loop */
+};
+
+/* Process CPU time, so other load on the machine doesn't skew the result */
+static unsigned long cpu_time_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (unsigned long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const uint8_t copy_program[] = {
+	/* 0150 start: */
+	0x21, 0x00, 0x40,	/* LD HL, 4000 */
+	0x11, 0x00, 0x80,	/* LD DE, 8000 */
+	0x01, 0x00, 0x18,	/* LD BC, 1800 */
+	/* 0159 loop: */
+	0x2A,			/* LD A, (HL+) */
+	0x12,			/* LD (DE), A */
+	0x13,			/* INC DE */
+	0x0B,			/* DEC BC */
+	0x78,			/* LD A, B */
+	0xB1,			/* OR C */
+	0x20, 0xF8,		/* JR NZ, loop */
+	0x18, 0xED,		/* JR start */
+};
+
+/* copy_program with a source that moves up a byte every pass, so every
+ * pass stores new tile data */
+static const uint8_t tiles_program[] = {
+	/* 0150 start: */
+	0xF0, 0x80,		/* LDH A, (80) */
+	0x3C,			/* INC A */
+	0xE0, 0x80,		/* LDH (80), A */
+	0x6F,			/* LD L, A */
+	0x26, 0x40,		/* LD H, 40 */
+	0x11, 0x00, 0x80,	/* LD DE, 8000 */
+	0x01, 0x00, 0x18,	/* LD BC, 1800 */
+	/* 015E loop: */
+	0x2A,			/* LD A, (HL+) */
+	0x12,			/* LD (DE), A */
+	0x13,			/* INC DE */
+	0x0B,			/* DEC BC */
+	0x78,			/* LD A, B */
+	0xB1,			/* OR C */
+	0x20, 0xF8,		/* JR NZ, loop */
+	0x18, 0xE8,		/* JR start */
+};
+
+int main(int argc, char** argv)
+{
+	const char* workload = argc > 1 ? argv[1] : "mix";
+	double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+	const uint8_t* program = nullptr;
+	size_t length = 0;
+
+	Serial.quiet = true;
+
+	if (!strcmp(workload, "mix")) {
+		program = mix_program;
+		length = sizeof(mix_program);
+	} else if (!strcmp(workload, "alu")) {
+		program = alu_program;
+		length = sizeof(alu_program);
+	} else if (!strcmp(workload, "copy")) {
+		program = copy_program;
+		length = sizeof(copy_program);
+	} else if (!strcmp(workload, "tiles")) {
+		program = tiles_program;
+		length = sizeof(tiles_program);
+	}
+
+	if (program) {
+		size_t size;
+		uint8_t* rom = host_make_rom(program, length, &size);
+		/* Source data for tiles, no two neighbouring bytes equal */
+		for (int i = 0; i < 0x1900; i++)
+			rom[0x4000 + i] = i * 7 + (i >> 8);
+		host_set_rom(rom, size);
+	} else {
+		if (!host_load_rom(workload))
+			return 1;
+		workload = "rom";
+	}
+
+	if (!host_init_emulator()) {
+		fprintf(stderr, "bench: emulator init failed\n");
+		return 1;
+	}
+
+	const unsigned long budget_us = (unsigned long)(seconds * 1e6);
+	const unsigned long start = cpu_time_us();
+	unsigned long elapsed = 0;
+	uint64_t cycles = 0;
+
+	while (elapsed < budget_us) {
+		if (!program)
+			cycles += host_run_frames(16);
+		else
+			for (int n = 0; n < 16; n++)
+				cycles += cpu_run(FRAME_CYCLES);
+		elapsed = cpu_time_us() - start;
+	}
+
+	const uint32_t instructions = cpu_get_instruction_count();
+	const double secs = elapsed / 1e6;
+	printf("core: %-8s policy: %-8s flags: %-5s tables: %-3s blocks: %-3s fusion: %-3s workload: %-3s instructions: %10u  M-cycles: %11llu  %7.2f MIPS  %5.2f ns/op  (%.1fx realtime)\n",
+	       CORE_NAME, POLICY_NAME, FLAGS_NAME, TABLES_NAME, BLOCKS_NAME, FUSION_NAME, workload,
+	       instructions, (unsigned long long)cycles,
+	       instructions / secs / 1e6,
+	       elapsed * 1e3 / instructions,
+	       cycles / secs / (4194304 / 4));
+	printf("blocks: %u hits, %u misses\n", cpu_get_block_hits(), cpu_get_block_misses());
+	if (!program)
+		printf("skipped: %.1f%% of M-cycles halted, %.1f%% in idle loops\n",
+		       cpu_get_halt_skipped_cycles() * 100.0 / cycles,
+		       cpu_get_idle_skipped_cycles() * 100.0 / cycles);
+	return 0;
+}
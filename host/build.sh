@@ -0,0 +1,72 @@
+#!/bin/bash
+# Builds the Linux host tools against the emulator core in ../espeon.
+# Usage: ./build.sh && ./build/bench_threaded
+set -e
+cd "$(dirname "$0")"
+
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-"-O2 -g"}
+CORE="../espeon/cpu.cpp ../espeon/mem.cpp ../espeon/mbc.cpp ../espeon/timer.cpp
+      ../espeon/interrupt.cpp ../espeon/rom.cpp ../espeon/lcd.cpp ../espeon/gb.cpp
+      ../espeon/profiler.cpp ../espeon/trace.cpp ../espeon/sched.cpp"
+
+# name and flags of each benchmark and opcode check variant
+VARIANTS=(
+	"switch   -DCPU_THREADED_DISPATCH=0"
+	"threaded -DCPU_THREADED_DISPATCH=1"
+	"eager    -DCPU_LAZY_FLAGS=0"
+	"notables -DCPU_ALU_TABLES=0"
+	"eager_notables -DCPU_LAZY_FLAGS=0 -DCPU_ALU_TABLES=0"
+	"nofusion -DCPU_FUSION=0"
+	"noblocks -DCPU_BLOCK_CACHE=0"
+	"accurate -DCPU_ACCURATE=1"
+	"trace    -DCPU_TRACE=1"
+	"novramdirty -DMEM_VRAM_DIRTY=0"
+)
+
+mkdir -p build
+for v in "${VARIANTS[@]}"; do
+	set -- $v
+	name=$1; shift
+	$CXX $CXXFLAGS -I. -DCPU_INSTRUCTION_COUNTER=1 "$@" \
+		-o build/bench_$name bench.cpp host.cpp $CORE
+	$CXX $CXXFLAGS -I. "$@" -o build/opcheck_$name opcheck.cpp host.cpp $CORE
+done
+
+# opcode pair report, counts every instruction so fusion stays off
+$CXX $CXXFLAGS -I. -DCPU_OPCODE_PAIRS=1 -DCPU_FUSION=0 \
+	-o build/pairs pairs.cpp host.cpp $CORE
+
+# per-opcode and hotspot profile with CSV output
+$CXX $CXXFLAGS -I. -DCPU_PROFILER=1 -DPROFILER_HOTSPOTS=16384 \
+	-o build/profile profile.cpp host.cpp $CORE
+
+# headless Blargg / Mooneye test ROM runner, accurate core and the fast
+# one the firmware ships
+$CXX $CXXFLAGS -I. -DCPU_INSTRUCTION_COUNTER=1 -DCPU_ACCURATE=1 \
+	-o build/testrom testrom.cpp host.cpp $CORE
+$CXX $CXXFLAGS -I. -DCPU_INSTRUCTION_COUNTER=1 \
+	-o build/testrom_fast testrom.cpp host.cpp $CORE
+$CXX $CXXFLAGS -I. -DCPU_INSTRUCTION_COUNTER=1 -DCPU_ACCURATE=1 -DCPU_TRACE=1 -DTRACE_RECORDS=4096 \
+	-o build/testrom_trace testrom.cpp host.cpp $CORE
+
+# opcode M-cycles and access slots against instr_timing, both policies
+$CXX $CXXFLAGS -I. -DCPU_ACCURATE=1 -o build/timingcheck timingcheck.cpp host.cpp $CORE
+$CXX $CXXFLAGS -I. -o build/timingcheck_fast timingcheck.cpp host.cpp $CORE
+
+# interrupt test ROMs, run them with irqtest.sh
+$CXX $CXXFLAGS -I. -o build/irqroms irqroms.cpp host.cpp $CORE
+
+# lazy LCD/timer catch-up against lockstep, both policies
+$CXX $CXXFLAGS -I. -DCPU_ACCURATE=1 -o build/synccheck synccheck.cpp host.cpp $CORE
+$CXX $CXXFLAGS -I. -o build/synccheck_fast synccheck.cpp host.cpp $CORE
+
+# timer interrupt latency after a TAC write, both policies
+$CXX $CXXFLAGS -I. -DCPU_ACCURATE=1 -o build/timercheck timercheck.cpp host.cpp $CORE
+$CXX $CXXFLAGS -I. -o build/timercheck_fast timercheck.cpp host.cpp $CORE
+
+# VRAM dirty bitmap check
+$CXX $CXXFLAGS -I. -o build/vramcheck vramcheck.cpp host.cpp $CORE
+
+# instruction trace decoder
+$CXX $CXXFLAGS -I. -o build/tracedump tracedump.cpp
@@ -0,0 +1,11 @@
+#ifndef HOST_ESP_HEAP_CAPS_H
+#define HOST_ESP_HEAP_CAPS_H
+
+#include <stddef.h>
+
+#define MALLOC_CAP_8BIT (1<<2)
+
+static inline size_t heap_caps_get_largest_free_block(int) { return 256 * 1024; }
+static inline bool heap_caps_check_integrity_all(bool) { return true; }
+
+#endif
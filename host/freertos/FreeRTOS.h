@@ -0,0 +1,18 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+/* The host build renders scanlines synchronously from lcd_cycle(), so the
+ * render queue and task are inert. */
+
+#include <stdint.h>
+
+typedef void* QueueHandle_t;
+typedef void* TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define portMAX_DELAY 0xFFFFFFFF
+#define pdTRUE 1
+#define pdFALSE 0
+
+#endif
@@ -0,0 +1,223 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "Arduino.h"
+#include "host.h"
+#include "../espeon/espeon.h"
+#include "../espeon/rom.h"
+#include "../espeon/mem.h"
+#include "../espeon/lcd.h"
+#include "../espeon/cpu.h"
+#include "../espeon/gb.h"
+#include "../espeon/trace.h"
+
+#define GAMEBOY_WIDTH 160
+#define GAMEBOY_HEIGHT 144
+#define ROM_BANK_SIZE (16*1024)
+
+HardwareSerial Serial;
+EspClass ESP;
+
+volatile bool sram_modified = false;
+uint16_t palette[] = { 0x0000, 0x5555, 0xAAAA, 0xFFFF };
+
+static fbuffer_t pixels[GAMEBOY_WIDTH * GAMEBOY_HEIGHT];
+static uint8_t* rom_data;
+static size_t rom_size;
+static uint32_t frame_count;
+static int frames_run;
+
+int HardwareSerial::printf(const char* fmt, ...)
+{
+	if (quiet)
+		return 0;
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vprintf(fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+size_t HardwareSerial::print(const char* s)
+{
+	if (quiet)
+		return 0;
+	return fputs(s, stdout) >= 0 ? strlen(s) : 0;
+}
+
+size_t HardwareSerial::println(const char* s)
+{
+	if (quiet)
+		return 0;
+	return printf("%s\n", s);
+}
+
+static uint64_t host_now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+unsigned long micros(void)
+{
+	static uint64_t start = host_now_us();
+	return (unsigned long)(host_now_us() - start);
+}
+
+unsigned long millis(void)
+{
+	return micros() / 1000;
+}
+
+void delay(unsigned long) {}
+void yield(void) {}
+
+bool host_load_rom(const char* path)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "host: cannot open %s\n", path);
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size < 0x8000) {
+		fprintf(stderr, "host: %s is too small to be a ROM\n", path);
+		fclose(f);
+		return false;
+	}
+	uint8_t* data = (uint8_t*)malloc(size);
+	if (!data || fread(data, 1, size, f) != (size_t)size) {
+		fprintf(stderr, "host: failed to read %s\n", path);
+		free(data);
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+
+	host_set_rom(data, size);
+	return true;
+}
+
+static const uint8_t nintendo_logo[] = {
+	0xCE, 0xED, 0x66, 0x66, 0xCC, 0x0D, 0x00, 0x0B,
+	0x03, 0x73, 0x00, 0x83, 0x00, 0x0C, 0x00, 0x0D,
+	0x00, 0x08, 0x11, 0x1F, 0x88, 0x89, 0x00, 0x0E,
+	0xDC, 0xCC, 0x6E, 0xE6, 0xDD, 0xDD, 0xD9, 0x99,
+	0xBB, 0xBB, 0x67, 0x63, 0x6E, 0x0E, 0xEC, 0xCC,
+	0xDD, 0xDC, 0x99, 0x9F, 0xBB, 0xB9, 0x33, 0x3E
+};
+
+uint8_t* host_make_rom(const uint8_t* program, size_t length, size_t* size)
+{
+	*size = 0x8000;
+	uint8_t* rom = (uint8_t*)calloc(1, *size);
+
+	/* Entry point: NOP; JP 0150 */
+	rom[0x100] = 0x00;
+	rom[0x101] = 0xC3;
+	rom[0x102] = 0x50;
+	rom[0x103] = 0x01;
+	memcpy(&rom[0x104], nintendo_logo, sizeof(nintendo_logo));
+	memcpy(&rom[0x134], "BENCH", 5);
+
+	uint8_t checksum = 0;
+	for (int i = 0x134; i <= 0x14C; i++)
+		checksum = checksum - rom[i] - 1;
+	rom[0x14D] = checksum;
+
+	memcpy(&rom[0x150], program, length);
+	return rom;
+}
+
+void host_set_rom(uint8_t* data, size_t size)
+{
+	if (rom_data != data)
+		free(rom_data);
+	rom_data = data;
+	rom_size = size;
+}
+
+const uint8_t* host_get_rom(void)
+{
+	return rom_data;
+}
+
+bool host_init_emulator(void)
+{
+	if (!rom_init(rom_data))
+		return false;
+	if (!mmu_init(nullptr))
+		return false;
+	if (!lcd_init())
+		return false;
+	cpu_init();
+	gb_init();
+	frames_run = 0;
+	return true;
+}
+
+uint64_t host_run_frames(int frames)
+{
+	uint64_t cycles = 0;
+
+	btn_directions = 0x0F;
+	for (int f = 0; f < frames; f++, frames_run++) {
+		btn_faces = (frames_run / 30) % 2 ? 0x07 : 0x0F;
+		uint32_t start = cpu_get_cycles();
+		gb_run_frame();
+		cycles += cpu_get_cycles() - start;
+	}
+	return cycles;
+}
+
+uint32_t host_get_frame_count(void)
+{
+	return frame_count;
+}
+
+/* espeon.h platform layer */
+
+const uint8_t* espeon_get_rom_bank(uint16_t bank_number)
+{
+	if (!rom_data)
+		return nullptr;
+	size_t offset = (size_t)bank_number * ROM_BANK_SIZE;
+	if (offset + ROM_BANK_SIZE > rom_size)
+		offset %= rom_size;
+	return rom_data + offset;
+}
+
+void espeon_update(void) {}
+
+void espeon_faint(const char* msg)
+{
+	fprintf(stderr, "Espeon fainted!\n%s\n", msg);
+	trace_dump();
+	exit(1);
+}
+
+fbuffer_t* espeon_get_framebuffer(void)
+{
+	return pixels;
+}
+
+void espeon_clear_framebuffer(fbuffer_t col)
+{
+	for (int i = 0; i < GAMEBOY_WIDTH * GAMEBOY_HEIGHT; i++)
+		pixels[i] = col;
+}
+
+void espeon_end_frame(void)
+{
+	frame_count++;
+}
+
+void espeon_save_sram(uint8_t*, uint32_t) {}
+void espeon_load_sram(uint8_t*, uint32_t) {}
+void espeon_cleanup_rom() {}
+void espeon_check_memory() {}
+uint8_t* espeon_get_preallocated_mbc_ram(size_t*) { return nullptr; }
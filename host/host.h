@@ -0,0 +1,28 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* ROM backing store for the host build. The image is owned by the host
+ * layer and served bank by bank through espeon_get_rom_bank().
+ * host_set_rom() takes over a malloc()ed image and frees the previous
+ * one; run host_init_emulator() again before using the new ROM. */
+bool host_load_rom(const char* path);
+void host_set_rom(uint8_t* data, size_t size);
+const uint8_t* host_get_rom(void);
+/* A 32 KB ROM-only cartridge with a valid header that jumps to program,
+ * copied to 0x0150. The rest is zero. Pass it to host_set_rom() or free
+ * it with free(). */
+uint8_t* host_make_rom(const uint8_t* program, size_t length, size_t* size);
+
+/* Brings up rom/mmu/lcd/cpu the same way setup() in espeon.ino does */
+bool host_init_emulator(void);
+/* Runs whole frames with START pressed every half second to get past
+ * title screens, carrying on from the previous call. Returns the
+ * M-cycles run. */
+uint64_t host_run_frames(int frames);
+
+uint32_t host_get_frame_count(void);
+
+#endif
@@ -0,0 +1,316 @@
+/*
+ * Interrupt test ROMs for the Linux host build.
+ *
+ *   irqroms dir
+ *
+ * Writes twelve small test ROMs to dir, one per interrupt behaviour the
+ * CPU core has to get right: the EI delay, EI followed by DI, IF and IE
+ * writes dispatching before the next instruction, HALT with IME clear
+ * and set, the HALT bug, priority and RETI, IME cleared on dispatch and
+ * timer and VBlank interrupts. They report like the Mooneye tests, 3 5 8
+ * 13 21 34 over serial when they pass and six 0x42 when they fail, so
+ * testrom runs them (see irqtest.sh). The fast core leaves out the EI
+ * delay and the HALT bug, so ei_delay, ei_di, rapid_di_ei and halt_bug
+ * are expected to fail on testrom_fast.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+
+#define PASS	0x0200
+#define FAIL	0x0240
+
+struct code {
+	uint8_t b[128];
+	int n;
+};
+
+static void put(struct code* c, const uint8_t* b, int n)
+{
+	memcpy(c->b + c->n, b, n);
+	c->n += n;
+}
+
+#define DB(c, ...) do { const uint8_t b_[] = { __VA_ARGS__ }; put(c, b_, sizeof(b_)); } while (0)
+
+/* LD A, v; LDH (reg), A */
+static void ldh(struct code* c, uint8_t reg, uint8_t v)
+{
+	DB(c, 0x3E, v, 0xE0, reg);
+}
+
+/* JP cc / JP (op C2, CA, C3) to PASS or FAIL */
+static void jp(struct code* c, uint8_t op, uint16_t to)
+{
+	DB(c, op, (uint8_t)to, (uint8_t)(to >> 8));
+}
+
+/* DI, SP, IF = IE = TAC = 0, BC = DE = 0 */
+static void setup(struct code* c)
+{
+	DB(c, 0xF3, 0x31, 0xFE, 0xDF);
+	DB(c, 0xAF, 0xE0, 0x0F, 0xE0, 0xFF, 0xE0, 0x07);
+	DB(c, 0x01, 0x00, 0x00, 0x11, 0x00, 0x00);
+}
+
+/* Timer running from TIMA = tima at 16 (05) or 4096 (04) clocks a tick */
+static void timer_start(struct code* c, uint8_t tima, uint8_t tac)
+{
+	ldh(c, 0x06, 0x00);
+	ldh(c, 0x05, tima);
+	ldh(c, 0x07, tac);
+}
+
+/* Passes if C (the handler count) or B equals v */
+static void pass_if(struct code* c, uint8_t reg_ld, uint8_t v)
+{
+	DB(c, reg_ld, 0xFE, v);		/* LD A, r; CP v */
+	jp(c, 0xCA, PASS);
+	jp(c, 0xC3, FAIL);
+}
+
+struct test {
+	const char* name;
+	/* main program at 0150, VBlank handler at 0040, timer at 0050 */
+	void (*build)(struct code* main, struct code* vblank, struct code* timer);
+};
+
+/* Handler that counts in C and returns */
+static void count(struct code* h)
+{
+	DB(h, 0x0C, 0xD9);		/* INC C; RETI */
+}
+
+/* The interrupt is taken after the instruction following EI */
+static void ei_delay(struct code* m, struct code*, struct code* t)
+{
+	setup(m);
+	ldh(m, 0xFF, 0x04);
+	ldh(m, 0x0F, 0x04);
+	DB(m, 0xFB, 0x04, 0x04, 0x04);	/* EI; INC B x3 */
+	jp(m, 0xC3, FAIL);
+	pass_if(t, 0x78, 0x01);
+}
+
+/* EI immediately followed by DI never takes the interrupt */
+static void ei_di(struct code* m, struct code*, struct code* t)
+{
+	setup(m);
+	ldh(m, 0xFF, 0x04);
+	ldh(m, 0x0F, 0x04);
+	DB(m, 0xFB, 0xF3, 0x00, 0x00, 0x00, 0x00);
+	DB(m, 0xF0, 0x0F, 0xE6, 0x04);	/* still requested */
+	jp(m, 0xC2, PASS);
+	jp(m, 0xC3, FAIL);
+	jp(t, 0xC3, FAIL);
+}
+
+/* Writing IF with IME and IE set dispatches before the next instruction */
+static void if_write(struct code* m, struct code*, struct code* t)
+{
+	setup(m);
+	ldh(m, 0xFF, 0x04);
+	DB(m, 0xFB, 0x00);
+	ldh(m, 0x0F, 0x04);
+	pass_if(m, 0x79, 0x01);
+	count(t);
+}
+
+/* Writing IE with IF already set dispatches before the next instruction */
+static void ie_write(struct code* m, struct code*, struct code* t)
+{
+	setup(m);
+	ldh(m, 0x0F, 0x04);
+	DB(m, 0xFB, 0x00, 0x00, 0x00, 0x00);
+	DB(m, 0x79, 0xB7);		/* nothing taken yet */
+	jp(m, 0xC2, FAIL);
+	ldh(m, 0xFF, 0x04);
+	pass_if(m, 0x79, 0x01);
+	count(t);
+}
+
+/* HALT with IME clear wakes on the timer without calling the handler */
+static void halt_ime0(struct code* m, struct code*, struct code* t)
+{
+	setup(m);
+	ldh(m, 0xFF, 0x04);
+	timer_start(m, 0xF0, 0x05);
+	DB(m, 0x76, 0x00);
+	DB(m, 0xF0, 0x0F, 0xE6, 0x04);	/* requested */
+	jp(m, 0xCA, FAIL);
+	DB(m, 0x79, 0xB7);		/* handler not run */
+	jp(m, 0xCA, PASS);
+	jp(m, 0xC3, FAIL);
+	count(t);
+}
+
+/* HALT with IME set runs the handler and returns after the HALT */
+static void halt_ime1(struct code* m, struct code*, struct code* t)
+{
+	setup(m);
+	ldh(m, 0xFF, 0x04);
+	timer_start(m, 0xF0, 0x05);
+	DB(m, 0xFB, 0x76, 0x00);
+	pass_if(m, 0x79, 0x01);
+	count(t);
+}
+
+/* HALT with IME clear and an interrupt pending runs the next byte twice */
+static void halt_bug(struct code* m, struct code*, struct code* t)
+{
+	setup(m);
+	ldh(m, 0xFF, 0x04);
+	ldh(m, 0x0F, 0x04);
+	DB(m, 0x76, 0x04);		/* HALT; INC B */
+	pass_if(m, 0x78, 0x02);
+	jp(t, 0xC3, FAIL);
+}
+
+/* VBlank is taken before the timer, the timer right after its RETI. The
+ * handlers log their vector to C000 on. */
+static void reti_priority(struct code* m, struct code* v, struct code* t)
+{
+	setup(m);
+	DB(m, 0x21, 0x00, 0xC0);	/* LD HL, C000 */
+	ldh(m, 0x0F, 0x05);
+	ldh(m, 0xFF, 0x05);
+	DB(m, 0xFB, 0x00, 0x00);
+	DB(m, 0x3E, 0xFF, 0x22);	/* end marker */
+	DB(m, 0xFA, 0x00, 0xC0, 0xFE, 0x40);
+	jp(m, 0xC2, FAIL);
+	DB(m, 0xFA, 0x01, 0xC0, 0xFE, 0x50);
+	jp(m, 0xC2, FAIL);
+	DB(m, 0xFA, 0x02, 0xC0, 0xFE, 0xFF);
+	jp(m, 0xCA, PASS);
+	jp(m, 0xC3, FAIL);
+	DB(v, 0x3E, 0x40, 0x22, 0xD9);
+	DB(t, 0x3E, 0x50, 0x22, 0xD9);
+}
+
+/* Dispatch clears IME: a request raised in the handler waits for RETI */
+static void ime_cleared(struct code* m, struct code*, struct code* t)
+{
+	setup(m);
+	ldh(m, 0xFF, 0x04);
+	ldh(m, 0x0F, 0x04);
+	DB(m, 0xFB, 0x00);
+	pass_if(m, 0x79, 0x02);
+	DB(t, 0x0C, 0x79, 0xFE, 0x01);	/* INC C; second time round: */
+	DB(t, 0x20, 0x0C);		/* JR NZ, done */
+	DB(t, 0x3E, 0x04, 0xE0, 0x0F, 0x00, 0x00);	/* request again */
+	DB(t, 0x79, 0xFE, 0x01);	/* not nested */
+	jp(t, 0xC2, FAIL);
+	DB(t, 0xD9);			/* done: RETI */
+}
+
+/* The timer interrupt reaches a busy loop */
+static void timer_irq(struct code* m, struct code*, struct code* t)
+{
+	setup(m);
+	ldh(m, 0xFF, 0x04);
+	timer_start(m, 0x00, 0x04);
+	DB(m, 0xFB, 0x11, 0xFF, 0xFF);	/* EI; LD DE, FFFF */
+	DB(m, 0x79, 0xB7);		/* loop: */
+	jp(m, 0xC2, PASS);
+	DB(m, 0x1B, 0x7A, 0xB3);	/* DEC DE; LD A, D; OR E */
+	DB(m, 0x20, 0xF6);		/* JR NZ, loop */
+	jp(m, 0xC3, FAIL);
+	count(t);
+}
+
+/* EI right before DI, over and over, never lets one through */
+static void rapid_di_ei(struct code* m, struct code*, struct code* t)
+{
+	setup(m);
+	ldh(m, 0xFF, 0x04);
+	ldh(m, 0x0F, 0x04);
+	for (int i = 0; i < 8; i++)
+		DB(m, 0xFB, 0xF3);
+	DB(m, 0xF0, 0x0F, 0xE6, 0x04);
+	jp(m, 0xC2, PASS);
+	jp(m, 0xC3, FAIL);
+	jp(t, 0xC3, FAIL);
+}
+
+/* The LCD's VBlank interrupt wakes a HALT */
+static void vblank_halt(struct code* m, struct code* v, struct code*)
+{
+	setup(m);
+	ldh(m, 0xFF, 0x01);
+	ldh(m, 0x40, 0x91);
+	DB(m, 0xFB, 0x76, 0x00);
+	pass_if(m, 0x79, 0x01);
+	count(v);
+}
+
+static const struct test tests[] = {
+	{ "ei_delay", ei_delay },
+	{ "ei_di", ei_di },
+	{ "if_write", if_write },
+	{ "ie_write", ie_write },
+	{ "halt_ime0", halt_ime0 },
+	{ "halt_ime1", halt_ime1 },
+	{ "halt_bug", halt_bug },
+	{ "reti_priority", reti_priority },
+	{ "ime_cleared", ime_cleared },
+	{ "timer_irq", timer_irq },
+	{ "rapid_di_ei", rapid_di_ei },
+	{ "vblank_halt", vblank_halt },
+};
+
+/* Sends the six bytes at table over serial, then spins */
+static void report(uint8_t* rom, uint16_t at, uint16_t table)
+{
+	const uint8_t send[] = {
+		0xF3,				/* DI */
+		0x21, (uint8_t)table, (uint8_t)(table >> 8),	/* LD HL, table */
+		0x06, 0x06,			/* LD B, 6 */
+		0x2A,				/* loop: LD A, (HL+) */
+		0xE0, 0x01,			/* LDH (01), A */
+		0x3E, 0x81,			/* LD A, 81 */
+		0xE0, 0x02,			/* LDH (02), A */
+		0xF0, 0x02,			/* wait: LDH A, (02) */
+		0xE6, 0x80,			/* AND 80 */
+		0x20, 0xFA,			/* JR NZ, wait */
+		0x05,				/* DEC B */
+		0x20, 0xF0,			/* JR NZ, loop */
+		0x18, 0xFE,			/* JR -2 */
+	};
+	memcpy(rom + at, send, sizeof(send));
+}
+
+int main(int argc, char** argv)
+{
+	static const uint8_t passed[] = { 3, 5, 8, 13, 21, 34 };
+	static const uint8_t failed[] = { 0x42, 0x42, 0x42, 0x42, 0x42, 0x42 };
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: irqroms dir\n");
+		return 1;
+	}
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		struct code m = {}, v = {}, t = {};
+		size_t size;
+		char path[512];
+
+		tests[i].build(&m, &v, &t);
+		uint8_t* rom = host_make_rom(m.b, m.n, &size);
+		memcpy(rom + 0x40, v.b, v.n);
+		memcpy(rom + 0x50, t.b, t.n);
+		report(rom, PASS, 0x280);
+		report(rom, FAIL, 0x290);
+		memcpy(rom + 0x280, passed, sizeof(passed));
+		memcpy(rom + 0x290, failed, sizeof(failed));
+
+		snprintf(path, sizeof(path), "%s/%s.gb", argv[1], tests[i].name);
+		FILE* f = fopen(path, "wb");
+		if (!f || fwrite(rom, 1, size, f) != size) {
+			fprintf(stderr, "irqroms: can't write %s\n", path);
+			return 1;
+		}
+		fclose(f);
+		free(rom);
+	}
+	return 0;
+}
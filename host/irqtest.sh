@@ -0,0 +1,19 @@
+#!/bin/bash
+# Writes the interrupt test ROMs (irqroms.cpp) to build/irq and runs them
+# on both cores. Run ./build.sh first.
+# Usage: ./irqtest.sh
+cd "$(dirname "$0")"
+
+mkdir -p build/irq
+./build/irqroms build/irq || exit 1
+
+# every ROM has to pass on the accurate core, the exit status is the
+# number that didn't
+./build/testrom -t 5 build/irq/*.gb
+status=$?
+
+# the fast core has no EI delay or HALT bug, so ei_delay, ei_di,
+# rapid_di_ei and halt_bug fail there by design
+./build/testrom_fast -t 5 build/irq/*.gb
+
+exit $status
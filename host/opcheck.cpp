@@ -0,0 +1,447 @@
+/*
+ * Opcode check for the Linux host build.
+ *
+ *   opcheck [cases]
+ *
+ * Runs every ALU opcode (8-bit arithmetic and logic, INC/DEC, the A
+ * rotates, DAA/CPL/SCF/CCF, 16-bit INC/DEC and ADD, ADD SP,e and
+ * LD HL,SP+e) and all 256 CB opcodes through the core from WRAM, `cases`
+ * times each (4000 by default) with random registers, flags, SP, (HL) and
+ * immediates biased towards carry and half carry edges. Every result is
+ * compared against a plain reference implementation below: A, F, BC, DE,
+ * HL, SP, the byte at (HL) and the M-cycles the instruction took. F is
+ * read back with PUSH AF, so lazily evaluated flags are checked the way a
+ * game would see them. Prints the first mismatch of each opcode that
+ * fails; the exit status is the number of failing opcodes.
+ *
+ * build.sh builds one per benchmark variant (opcheck_<variant>), so a core
+ * change can be checked in every configuration.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Arduino.h"
+#include "host.h"
+#include "../espeon/cpu.h"
+#include "../espeon/mem.h"
+
+#define FZ 0x80
+#define FN 0x40
+#define FH 0x20
+#define FC 0x10
+
+/* Where the test code, the register block and (HL) operands live */
+#define CODE 0xC000
+#define REGS 0xD000
+#define HL_LOW 0xC100
+#define HL_SPAN 0x0E00
+
+struct state {
+	uint8_t a, f, b, c, d, e, h, l;
+	uint16_t sp;
+	uint8_t hl_byte;	/* the byte at (HL) */
+	uint8_t imm;		/* d8 / e8 operand */
+	int cycles;
+};
+
+static uint32_t seed = 0x12345678;
+
+static uint8_t rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+/* A random byte, a quarter of the time one near a carry edge */
+static uint8_t rnd_operand(void)
+{
+	static const uint8_t edges[] = {
+		0x00, 0x01, 0x0F, 0x10, 0x7F, 0x80, 0xF0, 0xFF, 0x09, 0x90, 0x99, 0x9A
+	};
+	if (rnd() & 3)
+		return rnd();
+	return edges[rnd() % sizeof(edges)];
+}
+
+/* ---- reference ---- */
+
+static uint8_t* reg8(struct state* s, int r)
+{
+	switch (r) {
+	case 0: return &s->b;
+	case 1: return &s->c;
+	case 2: return &s->d;
+	case 3: return &s->e;
+	case 4: return &s->h;
+	case 5: return &s->l;
+	case 6: return &s->hl_byte;
+	default: return &s->a;
+	}
+}
+
+static uint16_t get16(struct state* s, int rr)
+{
+	switch (rr) {
+	case 0: return s->b << 8 | s->c;
+	case 1: return s->d << 8 | s->e;
+	case 2: return s->h << 8 | s->l;
+	default: return s->sp;
+	}
+}
+
+static void set16(struct state* s, int rr, uint16_t v)
+{
+	switch (rr) {
+	case 0: s->b = v >> 8; s->c = v; break;
+	case 1: s->d = v >> 8; s->e = v; break;
+	case 2: s->h = v >> 8; s->l = v; break;
+	default: s->sp = v; break;
+	}
+}
+
+static uint8_t zf(uint8_t v)
+{
+	return v ? 0 : FZ;
+}
+
+/* ADD ADC SUB SBC AND XOR OR CP */
+static void ref_alu(struct state* s, int kind, uint8_t v)
+{
+	int carry = (kind == 1 || kind == 3) && (s->f & FC) ? 1 : 0;
+	uint8_t a = s->a;
+	int r;
+
+	switch (kind) {
+	case 0:
+	case 1:
+		r = a + v + carry;
+		s->a = r;
+		s->f = zf(r & 0xFF) | ((a & 0xF) + (v & 0xF) + carry > 0xF ? FH : 0) | (r > 0xFF ? FC : 0);
+		break;
+	case 2:
+	case 3:
+	case 7:
+		r = a - v - carry;
+		s->f = zf(r & 0xFF) | FN | ((a & 0xF) - (v & 0xF) - carry < 0 ? FH : 0) | (r < 0 ? FC : 0);
+		if (kind != 7)
+			s->a = r;
+		break;
+	case 4: s->a = a & v; s->f = zf(s->a) | FH; break;
+	case 5: s->a = a ^ v; s->f = zf(s->a); break;
+	default: s->a = a | v; s->f = zf(s->a); break;
+	}
+}
+
+/* RLC RRC RL RR SLA SRA SWAP SRL, Z from the result */
+static uint8_t ref_shift(struct state* s, int kind, uint8_t v)
+{
+	uint8_t r, c;
+
+	switch (kind) {
+	case 0: c = v >> 7; r = v << 1 | c; break;
+	case 1: c = v & 1; r = v >> 1 | c << 7; break;
+	case 2: c = v >> 7; r = v << 1 | (s->f & FC ? 1 : 0); break;
+	case 3: c = v & 1; r = v >> 1 | (s->f & FC ? 0x80 : 0); break;
+	case 4: c = v >> 7; r = v << 1; break;
+	case 5: c = v & 1; r = (v >> 1) | (v & 0x80); break;
+	case 6: c = 0; r = v << 4 | v >> 4; break;
+	default: c = v & 1; r = v >> 1; break;
+	}
+	s->f = zf(r) | (c ? FC : 0);
+	return r;
+}
+
+static void ref_cb(struct state* s, uint8_t op)
+{
+	uint8_t* p = reg8(s, op & 7);
+	int bit = (op >> 3) & 7;
+
+	switch (op >> 6) {
+	case 0: *p = ref_shift(s, bit, *p); break;
+	case 1: s->f = (s->f & FC) | FH | ((*p >> bit) & 1 ? 0 : FZ); break;
+	case 2: *p &= ~(1 << bit); break;
+	default: *p |= 1 << bit; break;
+	}
+	if ((op & 7) != 6)
+		s->cycles = 2;
+	else
+		s->cycles = (op >> 6) == 1 ? 3 : 4;
+}
+
+static void ref_daa(struct state* s)
+{
+	uint8_t a = s->a;
+	bool carry = s->f & FC;
+
+	if (!(s->f & FN)) {
+		if (carry || a > 0x99) {
+			a += 0x60;
+			carry = true;
+		}
+		if ((s->f & FH) || (a & 0x0F) > 0x09)
+			a += 0x06;
+	} else {
+		if (carry)
+			a -= 0x60;
+		if (s->f & FH)
+			a -= 0x06;
+	}
+	s->a = a;
+	s->f = zf(a) | (s->f & FN) | (carry ? FC : 0);
+}
+
+static void ref_op(struct state* s, uint8_t op)
+{
+	if (op >= 0x80 && op <= 0xBF) {
+		ref_alu(s, (op >> 3) & 7, *reg8(s, op & 7));
+		s->cycles = (op & 7) == 6 ? 2 : 1;
+		return;
+	}
+	if ((op & 0xC7) == 0xC6) {
+		ref_alu(s, (op >> 3) & 7, s->imm);
+		s->cycles = 2;
+		return;
+	}
+	if ((op & 0xC6) == 0x04) {
+		/* INC r / DEC r, C untouched */
+		uint8_t* p = reg8(s, (op >> 3) & 7);
+		uint8_t f = s->f & FC;
+		if (op & 1) {
+			f |= FN | ((*p & 0xF) == 0 ? FH : 0);
+			(*p)--;
+		} else {
+			f |= (*p & 0xF) == 0xF ? FH : 0;
+			(*p)++;
+		}
+		s->f = f | zf(*p);
+		s->cycles = ((op >> 3) & 7) == 6 ? 3 : 1;
+		return;
+	}
+	if ((op & 0xC7) == 0x03) {
+		/* INC rr / DEC rr, no flags */
+		int rr = (op >> 4) & 3;
+		set16(s, rr, get16(s, rr) + (op & 8 ? -1 : 1));
+		s->cycles = 2;
+		return;
+	}
+	if ((op & 0xCF) == 0x09) {
+		uint16_t hl = get16(s, 2), v = get16(s, (op >> 4) & 3);
+		s->f = (s->f & FZ) | ((hl & 0xFFF) + (v & 0xFFF) > 0xFFF ? FH : 0) |
+		       (hl + v > 0xFFFF ? FC : 0);
+		set16(s, 2, hl + v);
+		s->cycles = 2;
+		return;
+	}
+	s->cycles = 1;
+	switch (op) {
+	case 0x07: s->a = ref_shift(s, 0, s->a); s->f &= FC; break;
+	case 0x0F: s->a = ref_shift(s, 1, s->a); s->f &= FC; break;
+	case 0x17: s->a = ref_shift(s, 2, s->a); s->f &= FC; break;
+	case 0x1F: s->a = ref_shift(s, 3, s->a); s->f &= FC; break;
+	case 0x27: ref_daa(s); break;
+	case 0x2F: s->a = ~s->a; s->f |= FN | FH; break;
+	case 0x37: s->f = (s->f & FZ) | FC; break;
+	case 0x3F: s->f = (s->f & FZ) | (s->f & FC ? 0 : FC); break;
+	case 0xE8:
+	case 0xF8: {
+		uint16_t r = s->sp + (int8_t)s->imm;
+		s->f = ((s->sp & 0xF) + (s->imm & 0xF) > 0xF ? FH : 0) |
+		       ((s->sp & 0xFF) + s->imm > 0xFF ? FC : 0);
+		if (op == 0xE8) {
+			s->sp = r;
+			s->cycles = 4;
+		} else {
+			set16(s, 2, r);
+			s->cycles = 3;
+		}
+		break;
+	}
+	}
+}
+
+/* ---- core ---- */
+
+static bool uses_hl(bool cb, uint8_t op)
+{
+	if (cb || (op >= 0x80 && op <= 0xBF))
+		return (op & 7) == 6;
+	return op == 0x34 || op == 0x35;
+}
+
+/* Loads the registers, runs the opcode, stores the registers and jumps
+ * back to CODE. Returns the number of instructions before the opcode. */
+static int emit(uint8_t* code, int* length, bool cb, uint8_t op, uint8_t imm, uint16_t sp)
+{
+	static const uint8_t load[] = {
+		0x31, REGS & 0xFF, REGS >> 8,	/* LD SP, REGS */
+		0xF1, 0xC1, 0xD1, 0xE1,		/* POP AF, BC, DE, HL */
+	};
+	static const uint8_t store[] = {
+		0x08, (REGS + 0x10) & 0xFF, (REGS + 0x10) >> 8,	/* LD (REGS+10), SP */
+		0x31, (REGS + 0x10) & 0xFF, (REGS + 0x10) >> 8,	/* LD SP, REGS+10 */
+		0xE5, 0xD5, 0xC5, 0xF5,				/* PUSH HL, DE, BC, AF */
+		0xC3, CODE & 0xFF, CODE >> 8,			/* JP CODE */
+	};
+	int n = 0;
+
+	memcpy(code, load, sizeof(load));
+	n += sizeof(load);
+	code[n++] = 0x31;	/* LD SP, sp */
+	code[n++] = sp;
+	code[n++] = sp >> 8;
+	if (cb) {
+		code[n++] = 0xCB;
+		code[n++] = op;
+	} else {
+		code[n++] = op;
+		if ((op & 0xC7) == 0xC6 || op == 0xE8 || op == 0xF8)
+			code[n++] = imm;
+	}
+	memcpy(code + n, store, sizeof(store));
+	*length = n + sizeof(store);
+	return 6;
+}
+
+static void run_core(struct state* s, bool cb, uint8_t op)
+{
+	uint8_t code[32];
+	int length;
+	int before = emit(code, &length, cb, op, s->imm, s->sp);
+	uint8_t regs[8] = { s->f, s->a, s->c, s->b, s->e, s->d, s->l, s->h };
+	uint16_t hl = s->h << 8 | s->l;
+
+	for (int i = 0; i < length; i++)
+		mem_write_byte(CODE + i, code[i]);
+	for (int i = 0; i < 8; i++)
+		mem_write_byte(REGS + i, regs[i]);
+	if (uses_hl(cb, op))
+		mem_write_byte(hl, s->hl_byte);
+
+	for (int i = 0; i < before; i++)
+		cpu_cycle();
+	s->cycles = cpu_cycle();
+	for (int i = 0; i < 7; i++)
+		cpu_cycle();
+
+	s->f = mem_get_byte(REGS + 8);
+	s->a = mem_get_byte(REGS + 9);
+	s->c = mem_get_byte(REGS + 10);
+	s->b = mem_get_byte(REGS + 11);
+	s->e = mem_get_byte(REGS + 12);
+	s->d = mem_get_byte(REGS + 13);
+	s->l = mem_get_byte(REGS + 14);
+	s->h = mem_get_byte(REGS + 15);
+	s->sp = mem_get_byte(REGS + 0x10) | mem_get_byte(REGS + 0x11) << 8;
+	if (uses_hl(cb, op))
+		s->hl_byte = mem_get_byte(hl);
+}
+
+/* ---- driver ---- */
+
+static bool is_alu(uint8_t op)
+{
+	if (op >= 0x80 && op <= 0xBF)
+		return true;
+	if ((op & 0xC7) == 0xC6 || (op & 0xC6) == 0x04 || (op & 0xC7) == 0x03 || (op & 0xCF) == 0x09)
+		return true;
+	switch (op) {
+	case 0x07: case 0x0F: case 0x17: case 0x1F:
+	case 0x27: case 0x2F: case 0x37: case 0x3F:
+	case 0xE8: case 0xF8:
+		return true;
+	}
+	return false;
+}
+
+static void print_state(const char* what, const struct state* s)
+{
+	printf("    %-4s A=%02X F=%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X (HL)=%02X cycles=%d\n",
+	       what, s->a, s->f, s->b, s->c, s->d, s->e, s->h, s->l, s->sp, s->hl_byte, s->cycles);
+}
+
+static bool check_opcode(bool cb, uint8_t op, int cases)
+{
+	for (int n = 0; n < cases; n++) {
+		struct state in, want, got;
+
+		in.a = rnd_operand();
+		in.f = rnd() & 0xF0;
+		in.b = rnd_operand();
+		in.c = rnd_operand();
+		in.d = rnd_operand();
+		in.e = rnd_operand();
+		in.h = rnd_operand();
+		in.l = rnd_operand();
+		in.sp = rnd_operand() << 8 | rnd_operand();
+		in.hl_byte = rnd_operand();
+		in.imm = rnd_operand();
+		in.cycles = 0;
+		if (uses_hl(cb, op)) {
+			uint16_t hl = HL_LOW + (rnd() << 8 | rnd()) % HL_SPAN;
+			in.h = hl >> 8;
+			in.l = hl;
+		}
+
+		want = in;
+		if (cb)
+			ref_cb(&want, op);
+		else
+			ref_op(&want, op);
+		got = in;
+		run_core(&got, cb, op);
+
+		if (memcmp(&want, &got, sizeof(want))) {
+			printf("FAIL    %s%02X", cb ? "CB " : "", op);
+			if (!cb && ((op & 0xC7) == 0xC6 || op == 0xE8 || op == 0xF8))
+				printf(" %02X", in.imm);
+			printf("\n");
+			print_state("in", &in);
+			print_state("want", &want);
+			print_state("got", &got);
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	/* JP CODE */
+	static const uint8_t program[] = { 0xC3, CODE & 0xFF, CODE >> 8 };
+	int cases = argc > 1 ? atoi(argv[1]) : 4000;
+	size_t size;
+
+	if (cases <= 0) {
+		fprintf(stderr, "usage: opcheck [cases]\n");
+		return 1;
+	}
+
+	Serial.quiet = true;
+	uint8_t* rom = host_make_rom(program, sizeof(program), &size);
+	host_set_rom(rom, size);
+	if (!host_init_emulator()) {
+		fprintf(stderr, "opcheck: emulator init failed\n");
+		return 1;
+	}
+	/* NOP; JP 0150; JP CODE */
+	for (int i = 0; i < 3; i++)
+		cpu_cycle();
+	if (cpu_get_pc() != CODE) {
+		fprintf(stderr, "opcheck: didn't get to %04X\n", CODE);
+		return 1;
+	}
+
+	int opcodes = 0, failed = 0;
+	for (int i = 0; i < 0x200; i++) {
+		bool cb = i >= 0x100;
+		uint8_t op = i;
+		if (!cb && !is_alu(op))
+			continue;
+		opcodes++;
+		if (!check_opcode(cb, op, cases))
+			failed++;
+	}
+	printf("%s, %d of %d opcodes, %d cases each\n", failed ? "FAIL" : "PASS",
+	       opcodes - failed, opcodes, cases);
+	return failed;
+}
@@ -0,0 +1,57 @@
+/*
+ * Opcode pair report for the Linux host build.
+ *
+ *   pairs rom.gb [frames] [top]
+ *
+ * Runs the ROM for a number of frames (default 3600, one minute of game
+ * time), pressing START every half second to get past title screens, then
+ * prints the most frequently executed opcode pairs. Built with fusion off,
+ * so every pair is counted as two separate instructions; this is the data
+ * the fused sequences in cpu.cpp were picked from.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "Arduino.h"
+#include "host.h"
+#include "../espeon/cpu.h"
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: pairs rom.gb [frames] [top]\n");
+		return 1;
+	}
+	const int frames = argc > 2 ? atoi(argv[2]) : 3600;
+	const int top = argc > 3 ? atoi(argv[3]) : 30;
+
+	Serial.quiet = true;
+	if (!host_load_rom(argv[1]))
+		return 1;
+	if (!host_init_emulator()) {
+		fprintf(stderr, "pairs: emulator init failed\n");
+		return 1;
+	}
+
+	host_run_frames(frames);
+
+	const uint32_t* pairs = cpu_get_opcode_pairs();
+	std::vector<uint32_t> order;
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < 256 * 256; i++) {
+		total += pairs[i];
+		if (pairs[i])
+			order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return pairs[a] > pairs[b];
+	});
+
+	printf("%s: %llu instructions over %d frames\n", argv[1],
+	       (unsigned long long)total, frames);
+	for (int i = 0; i < top && i < (int)order.size(); i++)
+		printf("%02X %02X  %10u  %5.2f%%\n", order[i] >> 8, order[i] & 0xFF,
+		       pairs[order[i]], pairs[order[i]] * 100.0 / total);
+	return 0;
+}
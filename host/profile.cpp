@@ -0,0 +1,45 @@
+/*
+ * Opcode and hotspot profile for the Linux host build.
+ *
+ *   profile rom.gb [frames] [out.csv] [top]
+ *
+ * Runs the ROM for a number of frames (default 3600) with the same START
+ * pulses as pairs, prints the top opcodes, CB opcodes and (bank, PC)
+ * hotspots by M-cycles and writes every counter to out.csv (default
+ * profile.csv). Built with -DCPU_PROFILER=1, see espeon/profiler.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "Arduino.h"
+#include "host.h"
+#include "../espeon/profiler.h"
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: profile rom.gb [frames] [out.csv] [top]\n");
+		return 1;
+	}
+	const int frames = argc > 2 ? atoi(argv[2]) : 3600;
+	const char* csv = argc > 3 ? argv[3] : "profile.csv";
+	const int top = argc > 4 ? atoi(argv[4]) : 20;
+
+	Serial.quiet = true;
+	if (!host_load_rom(argv[1]))
+		return 1;
+	if (!host_init_emulator()) {
+		fprintf(stderr, "profile: emulator init failed\n");
+		return 1;
+	}
+
+	host_run_frames(frames);
+
+	Serial.quiet = false;
+	profiler_dump(top);
+	if (!profiler_write_csv(csv)) {
+		fprintf(stderr, "profile: can't write %s\n", csv);
+		return 1;
+	}
+	printf("wrote %s\n", csv);
+	return 0;
+}
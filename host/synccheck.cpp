@@ -0,0 +1,174 @@
+/*
+ * Lazy catch-up check for the Linux host build.
+ *
+ *   synccheck [-f frames] rom.gb...
+ *
+ * Runs each ROM twice, once with the LCD and timer caught up only when
+ * needed (what the firmware does) and once in gb_lockstep, where they are
+ * brought up to date after every instruction, with the same START pulses
+ * as profile. After every frame both runs hash the screen, VRAM, WRAM,
+ * OAM, the I/O registers, HRAM and the CPU cycle count and PC; the first
+ * frame they disagree on is reported. Each run is a child process, so
+ * nothing left over from one can leak into the other. Prints how many
+ * catch-ups each mode did. The exit status is the number of ROMs that
+ * differ.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include "Arduino.h"
+#include "host.h"
+#include "../espeon/cpu.h"
+#include "../espeon/mem.h"
+#include "../espeon/interrupt.h"
+#include "../espeon/espeon.h"
+#include "../espeon/gb.h"
+
+#if defined(CPU_ACCURATE) && CPU_ACCURATE
+#define POLICY_NAME "accurate"
+#else
+#define POLICY_NAME "fast"
+#endif
+
+/* What a run sends back: one hash per frame, then the catch-up counts */
+struct summary {
+	uint32_t lcd_syncs, timer_syncs;
+};
+
+static uint64_t fnv(const void* p, size_t n, uint64_t h)
+{
+	const uint8_t* b = (const uint8_t*)p;
+	for (size_t i = 0; i < n; i++) {
+		h ^= b[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static uint64_t frame_hash(void)
+{
+	uint64_t h = 1469598103934665603ULL;
+	h = fnv(espeon_get_framebuffer(), 160 * 144 * sizeof(fbuffer_t), h);
+	h = fnv(mem_vram, 0x2000, h);
+	h = fnv(mem_wram, 0x2000, h);
+	h = fnv(mem_oam, 0x100, h);
+	h = fnv(mem_io, 0x80, h);
+	h = fnv(mem_hram, 0x80, h);
+	uint32_t cpu[] = { cpu_get_cycles(), cpu_get_pc(), IF, IE };
+	return fnv(cpu, sizeof(cpu), h);
+}
+
+static bool write_all(int fd, const void* p, size_t n)
+{
+	const char* b = (const char*)p;
+	while (n) {
+		ssize_t w = write(fd, b, n);
+		if (w <= 0)
+			return false;
+		b += w;
+		n -= w;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void* p, size_t n)
+{
+	char* b = (char*)p;
+	while (n) {
+		ssize_t r = read(fd, b, n);
+		if (r <= 0)
+			return false;
+		b += r;
+		n -= r;
+	}
+	return true;
+}
+
+/* Child side of run(), never returns */
+static void run_child(int fd, const char* path, int frames, bool lockstep)
+{
+	if (!host_load_rom(path) || !host_init_emulator())
+		_exit(2);
+	gb_lockstep = lockstep;
+	for (int f = 0; f < frames; f++) {
+		host_run_frames(1);
+		uint64_t h = frame_hash();
+		if (!write_all(fd, &h, sizeof(h)))
+			_exit(3);
+	}
+	struct summary s = { gb_lcd_syncs, gb_timer_syncs };
+	_exit(write_all(fd, &s, sizeof(s)) ? 0 : 3);
+}
+
+/* Runs the ROM in a child process, false if it didn't get to the end */
+static bool run(const char* path, int frames, bool lockstep,
+                std::vector<uint64_t>* hashes, struct summary* s)
+{
+	int fds[2];
+	if (pipe(fds))
+		return false;
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0)
+		return false;
+	if (pid == 0) {
+		close(fds[0]);
+		run_child(fds[1], path, frames, lockstep);
+	}
+	close(fds[1]);
+	hashes->resize(frames);
+	bool ok = read_all(fds[0], hashes->data(), frames * sizeof(uint64_t)) &&
+	          read_all(fds[0], s, sizeof(*s));
+	close(fds[0]);
+	int status;
+	waitpid(pid, &status, 0);
+	return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool check_rom(const char* path, int frames)
+{
+	std::vector<uint64_t> lazy, step;
+	struct summary ls, ss;
+
+	if (!run(path, frames, false, &lazy, &ls) || !run(path, frames, true, &step, &ss)) {
+		printf("ERROR   %s\n", path);
+		return false;
+	}
+	for (int f = 0; f < frames; f++) {
+		if (lazy[f] != step[f]) {
+			printf("DIFF    %-40s first at frame %d\n", path, f + 1);
+			return false;
+		}
+	}
+	printf("SAME    %-40s %d frames  catch-ups lazy %u LCD %u timer, lockstep %u LCD %u timer\n",
+	       path, frames, ls.lcd_syncs, ls.timer_syncs, ss.lcd_syncs, ss.timer_syncs);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	int frames = 600;
+	int first = 1;
+
+	if (argc > 2 && !strcmp(argv[1], "-f")) {
+		frames = atoi(argv[2]);
+		first = 3;
+	}
+	if (first >= argc || frames <= 0) {
+		fprintf(stderr, "usage: synccheck [-f frames] rom.gb...\n");
+		return 1;
+	}
+
+	Serial.quiet = true;
+	printf("policy: %s\n", POLICY_NAME);
+
+	int failed = 0;
+	for (int i = first; i < argc; i++)
+		if (!check_rom(argv[i], frames))
+			failed++;
+	printf("%d of %d match\n", argc - first - failed, argc - first);
+	return failed;
+}
@@ -0,0 +1,154 @@
+/*
+ * Headless test ROM runner for the Linux host build.
+ *
+ *   testrom [-t seconds] rom.gb...
+ *
+ * Runs each ROM until it reports a result or `seconds` of emulated time
+ * (default 120) have passed, and prints PASS, FAIL or TIMEOUT with the
+ * wall-clock speed. Results are picked up from:
+ *   - Blargg: the text sent over serial ("Passed" / "Failed"), or the
+ *     signature DE B0 61 at A001 with the result code at A000 and the text
+ *     at A004 for the tests that only write to cartridge RAM
+ *   - Mooneye: the bytes 3 5 8 13 21 34 sent over serial on success,
+ *     six 0x42 on failure
+ * The exit status is the number of ROMs that didn't pass. Built with
+ * -DCPU_TRACE=1 (testrom_trace) the last instructions of a ROM that
+ * didn't pass are written to rom.gb.trace for host/tracedump.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include "Arduino.h"
+#include "host.h"
+#include "../espeon/cpu.h"
+#include "../espeon/mem.h"
+#include "../espeon/mbc.h"
+#include "../espeon/gb.h"
+#include "../espeon/trace.h"
+
+#define FRAMES_PER_SECOND	60
+
+#if defined(CPU_ACCURATE) && CPU_ACCURATE
+#define POLICY_NAME "accurate"
+#else
+#define POLICY_NAME "fast"
+#endif
+
+enum { RUNNING, PASSED, FAILED };
+
+static std::string serial;
+
+static void serial_out(uint8_t c)
+{
+	serial += (char)c;
+}
+
+static int serial_result(std::string* text)
+{
+	static const char mooneye_pass[] = { 3, 5, 8, 13, 21, 34 };
+	static const char mooneye_fail[] = { 0x42, 0x42, 0x42, 0x42, 0x42, 0x42 };
+
+	if (serial.size() >= 6 && !serial.compare(serial.size() - 6, 6, mooneye_pass, 6))
+		return PASSED;
+	if (serial.size() >= 6 && !serial.compare(serial.size() - 6, 6, mooneye_fail, 6))
+		return FAILED;
+	if (serial.find("Passed") != std::string::npos) {
+		*text = serial;
+		return PASSED;
+	}
+	if (serial.find("Failed") != std::string::npos) {
+		*text = serial;
+		return FAILED;
+	}
+	return RUNNING;
+}
+
+/* Blargg's cartridge RAM report: A000 is 0x80 while the test runs */
+static int sram_result(std::string* text)
+{
+	const uint8_t* ram = mbc_get_ram();
+	if (!ram || ram[1] != 0xDE || ram[2] != 0xB0 || ram[3] != 0x61 || ram[0] == 0x80)
+		return RUNNING;
+	text->assign((const char*)&ram[4], strnlen((const char*)&ram[4], 0x1000));
+	return ram[0] == 0 ? PASSED : FAILED;
+}
+
+static double wall_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool run_rom(const char* path, int seconds)
+{
+	static const char* const names[] = { "TIMEOUT", "PASS", "FAIL" };
+
+	if (!host_load_rom(path))
+		return false;
+	if (!host_init_emulator()) {
+		fprintf(stderr, "testrom: emulator init failed for %s\n", path);
+		return false;
+	}
+	serial.clear();
+#if CPU_TRACE
+	trace_reset();
+#endif
+
+	const uint32_t instructions = cpu_get_instruction_count();
+	const double start = wall_time();
+	int result = RUNNING;
+	int frames = 0;
+	std::string text;
+
+	while (result == RUNNING && frames < seconds * FRAMES_PER_SECOND) {
+		gb_run_frame();
+		frames++;
+		result = serial_result(&text);
+		if (result == RUNNING && frames % FRAMES_PER_SECOND == 0)
+			result = sram_result(&text);
+	}
+
+	const double elapsed = wall_time() - start;
+	const uint32_t executed = cpu_get_instruction_count() - instructions;
+	printf("%-7s %-40s %6.1f s emulated  %6.2f s  %7.2f MIPS\n", names[result], path,
+	       (double)frames / FRAMES_PER_SECOND, elapsed, executed / elapsed / 1e6);
+	if (result != PASSED && !text.empty())
+		printf("%s\n", text.c_str());
+#if CPU_TRACE
+	if (result != PASSED) {
+		std::string trace = std::string(path) + ".trace";
+		if (trace_write(trace.c_str()))
+			printf("trace written to %s\n", trace.c_str());
+	}
+#endif
+	return result == PASSED;
+}
+
+int main(int argc, char** argv)
+{
+	int seconds = 120;
+	int first = 1;
+
+	if (argc > 2 && !strcmp(argv[1], "-t")) {
+		seconds = atoi(argv[2]);
+		first = 3;
+	}
+	if (first >= argc) {
+		fprintf(stderr, "usage: testrom [-t seconds] rom.gb...\n");
+		return 1;
+	}
+
+	Serial.quiet = true;
+	mem_serial_out = serial_out;
+	printf("policy: %s\n", POLICY_NAME);
+
+	int failed = 0;
+	for (int i = first; i < argc; i++)
+		if (!run_rom(argv[i], seconds))
+			failed++;
+	printf("%d of %d passed\n", argc - first - failed, argc - first);
+	return failed;
+}
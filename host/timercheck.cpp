@@ -0,0 +1,98 @@
+/*
+ * Timer interrupt latency check for the Linux host build.
+ *
+ *   timercheck
+ *
+ * Starts the timer at 1024 clocks per tick, lets it bank a few hundred
+ * clocks, sets TIMA to FF and switches TAC to 16 clocks per tick. The
+ * next overflow is then at most 4 M-cycles away. After the TAC write the
+ * program counts M-cycles in C with INC C until the timer interrupt is
+ * taken; the handler stores C in HRAM. This is checked once with the LCD
+ * and timer caught up lazily (what the firmware does) and once in
+ * gb_lockstep. The interrupt has to arrive within 4 M-cycles in both.
+ * The exit status is the number of failed modes.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "Arduino.h"
+#include "host.h"
+#include "../espeon/mem.h"
+#include "../espeon/gb.h"
+
+#if defined(CPU_ACCURATE) && CPU_ACCURATE
+#define POLICY_NAME "accurate"
+#else
+#define POLICY_NAME "fast"
+#endif
+
+/* M-cycles counted after the TAC write before giving up */
+#define COUNT 32
+
+/* Runs the program once, returns the M-cycles counted or -1 */
+static int run(bool lockstep)
+{
+	static const uint8_t program[] = {
+		/* 0150 */
+		0xF3,			/* DI */
+		0x31, 0xFE, 0xDF,	/* LD SP, DFFE */
+		0xAF,			/* XOR A */
+		0xE0, 0x0F,		/* LDH (0F), A */
+		0xE0, 0x05,		/* LDH (05), A */
+		0xE0, 0x06,		/* LDH (06), A */
+		0x3E, 0xFF,		/* LD A, FF */
+		0xE0, 0x80,		/* LDH (80), A */
+		0x3E, 0x04,		/* LD A, 04 */
+		0xE0, 0xFF,		/* LDH (FF), A */
+		0xE0, 0x07,		/* LDH (07), A   timer on, 1024 */
+		0x06, 0x30,		/* LD B, 30 */
+		/* 0167 wait: 4 M-cycles a pass, about 800 clocks banked */
+		0x05,			/* DEC B */
+		0x20, 0xFD,		/* JR NZ, wait */
+		0x3E, 0xFF,		/* LD A, FF */
+		0xE0, 0x05,		/* LDH (05), A */
+		0x0E, 0x00,		/* LD C, 00 */
+		0xFB,			/* EI */
+		0x3E, 0x05,		/* LD A, 05 */
+		0xE0, 0x07,		/* LDH (07), A   16 clocks per tick */
+	};
+	uint8_t code[sizeof(program) + COUNT + 2];
+	size_t size;
+
+	memcpy(code, program, sizeof(program));
+	memset(code + sizeof(program), 0x0C, COUNT);	/* INC C */
+	code[sizeof(code) - 2] = 0x18;			/* JR -2 */
+	code[sizeof(code) - 1] = 0xFE;
+
+	uint8_t* rom = host_make_rom(code, sizeof(code), &size);
+	/* 0050: LD A, C; LDH (80), A; JR -2 */
+	static const uint8_t handler[] = { 0x79, 0xE0, 0x80, 0x18, 0xFE };
+	memcpy(rom + 0x50, handler, sizeof(handler));
+	host_set_rom(rom, size);
+	if (!host_init_emulator())
+		return -1;
+	gb_lockstep = lockstep;
+	gb_run_frame();
+	uint8_t counted = mem_get_byte(0xFF80);
+	return counted == 0xFF ? -1 : counted;
+}
+
+int main(void)
+{
+	Serial.quiet = true;
+	printf("policy: %s\n", POLICY_NAME);
+
+	int failed = 0;
+	for (int lockstep = 0; lockstep < 2; lockstep++) {
+		int counted = run(lockstep);
+		bool ok = counted >= 0 && counted <= 4;
+		if (counted < 0)
+			printf("FAIL    %-8s no timer interrupt within %d M-cycles of the TAC write\n",
+			       lockstep ? "lockstep" : "lazy", COUNT);
+		else
+			printf("%s    %-8s timer interrupt %d M-cycles after the TAC write\n",
+			       ok ? "PASS" : "FAIL", lockstep ? "lockstep" : "lazy", counted);
+		if (!ok)
+			failed++;
+	}
+	return failed;
+}
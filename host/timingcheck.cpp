@@ -0,0 +1,317 @@
+/*
+ * Instruction timing check for the Linux host build.
+ *
+ *   timingcheck
+ *
+ * Runs every opcode and CB opcode once with the flags cleared and once
+ * with them set, so conditional jumps, calls and returns are timed both
+ * taken and not taken, and compares the M-cycles each took against the
+ * tables of Blargg's instr_timing. BC, DE, HL, SP and every address
+ * operand point at a window of I/O registers whose handlers record the
+ * cycle of each access. With M-cycle timing (the accurate core) the
+ * reads and writes have to land on the M-cycles the hardware uses, counted
+ * from the opcode fetch, which checks bus_offset[] in espeon/cpu.cpp.
+ * Each opcode runs from ROM (the block cache) and from WRAM (decoded as
+ * it runs). STOP, HALT and the unused opcodes are skipped. Prints every
+ * mismatch; the exit status is their number.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "Arduino.h"
+#include "host.h"
+#include "../espeon/cpu.h"
+#include "../espeon/mem.h"
+#include "../espeon/policy.h"
+
+#if defined(CPU_ACCURATE) && CPU_ACCURATE
+#define POLICY_NAME "accurate"
+#else
+#define POLICY_NAME "fast"
+#endif
+
+/* M-cycles per opcode from instr_timing, not taken and taken. 0 is not
+ * tested. */
+static const uint8_t timing_not_taken[256] = {
+	1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
+	0, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
+	2, 3, 2, 2, 1, 1, 2, 1, 2, 2, 2, 2, 1, 1, 2, 1,
+	2, 3, 2, 2, 3, 3, 3, 1, 2, 2, 2, 2, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	2, 2, 2, 2, 2, 2, 0, 2, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 3, 4, 3, 4, 2, 4, 2, 4, 3, 0, 3, 6, 2, 4,
+	2, 3, 3, 0, 3, 4, 2, 4, 2, 4, 3, 0, 3, 0, 2, 4,
+	3, 3, 2, 0, 0, 4, 2, 4, 4, 1, 4, 0, 0, 0, 2, 4,
+	3, 3, 2, 1, 0, 4, 2, 4, 3, 2, 4, 1, 0, 0, 2, 4,
+};
+
+static const uint8_t timing_taken[256] = {
+	1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
+	0, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
+	3, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
+	3, 3, 2, 2, 3, 3, 3, 1, 3, 2, 2, 2, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	2, 2, 2, 2, 2, 2, 0, 2, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	5, 3, 4, 4, 6, 4, 2, 4, 5, 4, 4, 0, 6, 6, 2, 4,
+	5, 3, 4, 0, 6, 4, 2, 4, 5, 4, 4, 0, 6, 0, 2, 4,
+	3, 3, 2, 0, 0, 4, 2, 4, 4, 1, 4, 0, 0, 0, 2, 4,
+	3, 3, 2, 1, 0, 4, 2, 4, 3, 2, 4, 1, 0, 0, 2, 4,
+};
+
+/* The I/O window every address operand points into. Pushes go to
+ * PROBE+7 and +6, pops read PROBE+8 and +9. */
+#define PROBE		0xFF72
+#define PROBE_SIZE	10
+#define PROBE_SP	(PROBE + 8)
+#define CODE		0xC000
+
+#define MAX_ACCESSES	4
+
+/* Data accesses of one instruction, 'R' or 'W' and the M-cycle */
+struct accesses {
+	int n;
+	char kind[MAX_ACCESSES];
+	int cycle[MAX_ACCESSES];
+};
+
+static bool recording;
+static uint32_t start;
+static struct accesses seen;
+
+static void record(char kind)
+{
+	if (!recording || seen.n == MAX_ACCESSES)
+		return;
+	seen.kind[seen.n] = kind;
+	seen.cycle[seen.n] = cpu_get_cycles() - start;
+	seen.n++;
+}
+
+static uint8_t probe_read(uint16_t)
+{
+	record('R');
+	return 0;
+}
+
+static void probe_write(uint16_t, uint8_t)
+{
+	record('W');
+}
+
+static void expect(struct accesses* a, const char* list)
+{
+	a->n = 0;
+	for (; list[0]; list += 2) {
+		a->kind[a->n] = list[0];
+		a->cycle[a->n] = list[1] - '0';
+		a->n++;
+	}
+}
+
+/* The hardware's data accesses, from the opcode fetch at M-cycle 0 */
+static void expected_accesses(bool cb, uint8_t op, bool taken, struct accesses* a)
+{
+	if (cb) {
+		if ((op & 7) != 6)
+			expect(a, "");
+		else
+			expect(a, (op >> 6) == 1 ? "R2" : "R2W3");
+		return;
+	}
+	if (op >= 0x70 && op <= 0x77 && op != 0x76) {
+		expect(a, "W1");
+		return;
+	}
+	if ((op >= 0x40 && op <= 0xBF && (op & 7) == 6) || (op & 0xCF) == 0x0A) {
+		expect(a, "R1");	/* LD r,(HL), ALU (HL), LD A,(rr) */
+		return;
+	}
+	if ((op & 0xCF) == 0x02) {
+		expect(a, "W1");	/* LD (rr),A */
+		return;
+	}
+	if ((op & 0xCF) == 0xC1) {
+		expect(a, "R1R2");	/* POP */
+		return;
+	}
+	if ((op & 0xCF) == 0xC5 || (op & 0xC7) == 0xC7) {
+		expect(a, "W2W3");	/* PUSH, RST */
+		return;
+	}
+	switch (op) {
+	case 0x08: expect(a, "W3W4"); return;
+	case 0x34: case 0x35: expect(a, "R1W2"); return;
+	case 0x36: expect(a, "W2"); return;
+	case 0xC9: case 0xD9: expect(a, "R1R2"); return;
+	case 0xC0: case 0xC8: case 0xD0: case 0xD8: expect(a, taken ? "R2R3" : ""); return;
+	case 0xC4: case 0xCC: case 0xD4: case 0xDC: expect(a, taken ? "W4W5" : ""); return;
+	case 0xCD: expect(a, "W4W5"); return;
+	case 0xE0: case 0xF0: expect(a, op == 0xE0 ? "W2" : "R2"); return;
+	case 0xE2: case 0xF2: expect(a, op == 0xE2 ? "W1" : "R1"); return;
+	case 0xEA: case 0xFA: expect(a, op == 0xEA ? "W3" : "R3"); return;
+	}
+	expect(a, "");
+}
+
+static int immediate_bytes(uint8_t op)
+{
+	switch (op) {
+	case 0x01: case 0x11: case 0x21: case 0x31: case 0x08:
+	case 0xC2: case 0xC3: case 0xC4: case 0xCA: case 0xCC: case 0xCD:
+	case 0xD2: case 0xD4: case 0xDA: case 0xDC: case 0xEA: case 0xFA:
+		return 2;
+	case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+	case 0xE0: case 0xF0: case 0xE8: case 0xF8: case 0xCB:
+		return 1;
+	}
+	return (op & 0xC7) == 0x06 || (op & 0xC7) == 0xC6 ? 1 : 0;
+}
+
+static bool is_conditional(uint8_t op)
+{
+	return (op & 0xE7) == 0x20 || (op & 0xE7) == 0xC0 || (op & 0xE7) == 0xC2 || (op & 0xE7) == 0xC4;
+}
+
+static void format(char* out, const struct accesses* a)
+{
+	out[0] = 0;
+	for (int i = 0; i < a->n; i++)
+		out += sprintf(out, i ? " %c%d" : "%c%d", a->kind[i], a->cycle[i]);
+}
+
+/* Runs one instruction, returns its M-cycles or -1. Sets F, points
+ * BC/DE/HL at PROBE and SP at PROBE_SP first. */
+static int run(bool cb, uint8_t op, uint8_t flags, bool wram, struct accesses* a)
+{
+	uint8_t code[32];
+	int n = 0;
+	const uint8_t setup[] = {
+		0xF3,				/* DI */
+		0x31, 0xF0, 0xDF,		/* LD SP, DFF0 */
+		0x01, flags, 0x00,		/* LD BC, 00 flags */
+		0xC5, 0xF1,			/* PUSH BC; POP AF */
+		0x01, PROBE & 0xFF, PROBE >> 8,	/* LD BC, PROBE */
+		0x11, PROBE & 0xFF, PROBE >> 8,	/* LD DE, PROBE */
+		0x21, PROBE & 0xFF, PROBE >> 8,	/* LD HL, PROBE */
+		0x31, PROBE_SP & 0xFF, PROBE_SP >> 8,	/* LD SP, PROBE_SP */
+	};
+	memcpy(code, setup, sizeof(setup));
+	n = sizeof(setup);
+	uint16_t at = (wram ? CODE : 0x150) + n;
+	if (cb) {
+		code[n++] = 0xCB;
+		code[n++] = op;
+	} else {
+		code[n++] = op;
+		if (immediate_bytes(op) >= 1)
+			code[n++] = PROBE & 0xFF;
+		if (immediate_bytes(op) == 2)
+			code[n++] = PROBE >> 8;
+	}
+	code[n++] = 0x18;	/* JR -2 */
+	code[n++] = 0xFE;
+
+	static const uint8_t jump[] = { 0xC3, CODE & 0xFF, CODE >> 8 };	/* JP CODE */
+	size_t size;
+	uint8_t* rom = wram ? host_make_rom(jump, sizeof(jump), &size) : host_make_rom(code, n, &size);
+	host_set_rom(rom, size);
+	if (!host_init_emulator())
+		return -1;
+	if (wram)
+		for (int i = 0; i < n; i++)
+			mem_write_byte(CODE + i, code[i]);
+	for (int i = 0; i < PROBE_SIZE; i++)
+		mem_io_handler(PROBE + i, probe_read, probe_write);
+
+	for (int i = 0; cpu_get_pc() != at; i++)
+		if (i == 32)
+			return -1;
+		else
+			cpu_cycle();
+
+	seen.n = 0;
+	start = cpu_get_cycles();
+	recording = true;
+	int cycles = cpu_cycle();
+	recording = false;
+	*a = seen;
+	return cycles;
+}
+
+static int check(bool cb, uint8_t op, uint8_t flags, bool wram)
+{
+	const char* where = wram ? "WRAM" : "ROM";
+	bool taken = false;
+	int want;
+
+	if (cb) {
+		want = (op & 7) != 6 ? 2 : (op >> 6) == 1 ? 3 : 4;
+	} else {
+		/* NZ/NC are taken with the flags clear, Z/C with them set */
+		if (is_conditional(op))
+			taken = (op & 0x08) ? flags != 0 : flags == 0;
+		want = taken ? timing_taken[op] : timing_not_taken[op];
+	}
+
+	struct accesses got, expected;
+	int cycles = run(cb, op, flags, wram, &got);
+	int failed = 0;
+	char name[8];
+	sprintf(name, cb ? "CB %02X" : "%02X", op);
+
+	if (cycles < 0) {
+		printf("ERROR   %-5s F=%02X %-4s didn't reach the instruction\n", name, flags, where);
+		return 1;
+	}
+	if (cycles != want) {
+		printf("FAIL    %-5s F=%02X %-4s %d M-cycles, want %d\n", name, flags, where, cycles, want);
+		failed++;
+	}
+	/* Without M-cycle timing every access is at the start */
+	if (CpuPolicy::mcycle_timing) {
+		expected_accesses(cb, op, taken, &expected);
+		if (got.n != expected.n || memcmp(got.kind, expected.kind, got.n) ||
+		    memcmp(got.cycle, expected.cycle, got.n * sizeof(int))) {
+			char g[32], e[32];
+			format(g, &got);
+			format(e, &expected);
+			printf("FAIL    %-5s F=%02X %-4s accesses %s, want %s\n", name, flags, where,
+			       got.n ? g : "none", expected.n ? e : "none");
+			failed++;
+		}
+	}
+	return failed;
+}
+
+int main(void)
+{
+	Serial.quiet = true;
+	printf("policy: %s\n", POLICY_NAME);
+
+	int failed = 0, checked = 0;
+	for (int i = 0; i < 0x200; i++) {
+		bool cb = i >= 0x100;
+		uint8_t op = i;
+		if (!cb && (!timing_not_taken[op] || op == 0x10))
+			continue;
+		for (int wram = 0; wram < 2; wram++) {
+			failed += check(cb, op, 0x00, wram);
+			failed += check(cb, op, 0xF0, wram);
+			checked += 2;
+		}
+	}
+	printf("%s, %d runs, %d mismatches%s\n", failed ? "FAIL" : "PASS", checked, failed,
+	       CpuPolicy::mcycle_timing ? "" : " (cycle counts only)");
+	return failed;
+}
@@ -0,0 +1,191 @@
+/*
+ * Instruction trace decoder for the Linux host build.
+ *
+ *   tracedump trace.bin|serial.log
+ *
+ * Reads a trace written by trace_write() or a serial log holding the
+ * "TRACE:" lines of trace_dump() (anything else in the log is skipped)
+ * and prints one disassembled instruction per record, oldest first, with
+ * the registers as they were before it ran. See espeon/trace.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../espeon/trace.h"
+
+/* d8/a8/r8 take one immediate byte, d16/a16 two */
+static const char* const mnemonics[256] = {
+	"NOP", "LD BC,d16", "LD (BC),A", "INC BC", "INC B", "DEC B", "LD B,d8", "RLCA",
+	"LD (a16),SP", "ADD HL,BC", "LD A,(BC)", "DEC BC", "INC C", "DEC C", "LD C,d8", "RRCA",
+	"STOP", "LD DE,d16", "LD (DE),A", "INC DE", "INC D", "DEC D", "LD D,d8", "RLA",
+	"JR r8", "ADD HL,DE", "LD A,(DE)", "DEC DE", "INC E", "DEC E", "LD E,d8", "RRA",
+	"JR NZ,r8", "LD HL,d16", "LD (HL+),A", "INC HL", "INC H", "DEC H", "LD H,d8", "DAA",
+	"JR Z,r8", "ADD HL,HL", "LD A,(HL+)", "DEC HL", "INC L", "DEC L", "LD L,d8", "CPL",
+	"JR NC,r8", "LD SP,d16", "LD (HL-),A", "INC SP", "INC (HL)", "DEC (HL)", "LD (HL),d8", "SCF",
+	"JR C,r8", "ADD HL,SP", "LD A,(HL-)", "DEC SP", "INC A", "DEC A", "LD A,d8", "CCF",
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,	/* 40-7F LD r,r' and HALT */
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,	/* 80-BF ALU A,r */
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	"RET NZ", "POP BC", "JP NZ,a16", "JP a16", "CALL NZ,a16", "PUSH BC", "ADD A,d8", "RST 00",
+	"RET Z", "RET", "JP Z,a16", NULL, "CALL Z,a16", "CALL a16", "ADC A,d8", "RST 08",
+	"RET NC", "POP DE", "JP NC,a16", "???", "CALL NC,a16", "PUSH DE", "SUB d8", "RST 10",
+	"RET C", "RETI", "JP C,a16", "???", "CALL C,a16", "???", "SBC A,d8", "RST 18",
+	"LDH (a8),A", "POP HL", "LD (C),A", "???", "???", "PUSH HL", "AND d8", "RST 20",
+	"ADD SP,r8", "JP (HL)", "LD (a16),A", "???", "???", "???", "XOR d8", "RST 28",
+	"LDH A,(a8)", "POP AF", "LD A,(C)", "DI", "???", "PUSH AF", "OR d8", "RST 30",
+	"LD HL,SP+r8", "LD SP,HL", "LD A,(a16)", "EI", "???", "???", "CP d8", "RST 38",
+};
+
+static const char* const regs[8] = { "B", "C", "D", "E", "H", "L", "(HL)", "A" };
+static const char* const alu[8] = { "ADD A,", "ADC A,", "SUB ", "SBC A,", "AND ", "XOR ", "OR ", "CP " };
+static const char* const rot[8] = { "RLC", "RRC", "RL", "RR", "SLA", "SRA", "SWAP", "SRL" };
+
+/* Writes the instruction at pc to out, returns its length */
+static int disassemble(char* out, size_t size, uint16_t pc, uint8_t op, uint16_t imm)
+{
+	if (op >= 0x40 && op < 0x80) {
+		if (op == 0x76)
+			snprintf(out, size, "HALT");
+		else
+			snprintf(out, size, "LD %s,%s", regs[(op >> 3) & 7], regs[op & 7]);
+		return 1;
+	}
+	if (op >= 0x80 && op < 0xC0) {
+		snprintf(out, size, "%s%s", alu[(op >> 3) & 7], regs[op & 7]);
+		return 1;
+	}
+	if (op == 0xCB) {
+		uint8_t cb = imm & 0xFF;
+		if (cb < 0x40)
+			snprintf(out, size, "%s %s", rot[cb >> 3], regs[cb & 7]);
+		else
+			snprintf(out, size, "%s %d,%s", cb < 0x80 ? "BIT" : cb < 0xC0 ? "RES" : "SET",
+			         (cb >> 3) & 7, regs[cb & 7]);
+		return 2;
+	}
+
+	const char* m = mnemonics[op];
+	/* The placeholders are the only lower case in the table */
+	const char* arg = strpbrk(m, "dar");
+	if (!arg) {
+		snprintf(out, size, "%s", m);
+		return 1;
+	}
+
+	int len = arg[1] == '8' ? 2 : 3;
+	char value[16];
+	if (arg[0] == 'r') {
+		int8_t rel = (int8_t)(imm & 0xFF);
+		if (op == 0xE8 || op == 0xF8)
+			snprintf(value, sizeof(value), "%d", rel);
+		else
+			snprintf(value, sizeof(value), "%04X", (uint16_t)(pc + 2 + rel));
+	} else if (arg[0] == 'a' && len == 2) {
+		snprintf(value, sizeof(value), "FF%02X", imm & 0xFF);
+	} else if (len == 2) {
+		snprintf(value, sizeof(value), "%02X", imm & 0xFF);
+	} else {
+		snprintf(value, sizeof(value), "%04X", imm);
+	}
+	snprintf(out, size, "%.*s%s%s", (int)(arg - m), m, value, arg + (len == 2 ? 2 : 3));
+	return len;
+}
+
+static bool read_binary(FILE* f, std::vector<trace_record>* records)
+{
+	char magic[8];
+	uint32_t header[2];
+	if (fread(magic, 1, 8, f) != 8 || memcmp(magic, "GBTRACE", 8))
+		return false;
+	if (fread(header, sizeof(header), 1, f) != 1 || header[1] != sizeof(trace_record)) {
+		fprintf(stderr, "tracedump: unsupported record size\n");
+		return false;
+	}
+	records->resize(header[0]);
+	return fread(records->data(), sizeof(trace_record), header[0], f) == header[0];
+}
+
+/* Picks the "TRACE: <hex>" lines out of a serial log. A later dump in the
+ * same log replaces an earlier one. */
+static bool read_log(FILE* f, std::vector<trace_record>* records)
+{
+	char line[256];
+	bool found = false;
+	while (fgets(line, sizeof(line), f)) {
+		const char* p = strstr(line, "TRACE: ");
+		if (!p)
+			continue;
+		p += 7;
+		if (!strncmp(p, "begin", 5)) {
+			records->clear();
+			found = true;
+			continue;
+		}
+		trace_record r;
+		uint8_t* bytes = (uint8_t*)&r;
+		size_t n = 0;
+		unsigned int v;
+		while (n < sizeof(r) && sscanf(p + 2 * n, "%2x", &v) == 1)
+			bytes[n++] = v;
+		if (n == sizeof(r))
+			records->push_back(r);
+	}
+	return found;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: tracedump trace.bin|serial.log\n");
+		return 1;
+	}
+	FILE* f = fopen(argv[1], "rb");
+	if (!f) {
+		perror(argv[1]);
+		return 1;
+	}
+	std::vector<trace_record> records;
+	if (!read_binary(f, &records)) {
+		rewind(f);
+		if (!read_log(f, &records)) {
+			fprintf(stderr, "tracedump: no trace in %s\n", argv[1]);
+			return 1;
+		}
+	}
+	fclose(f);
+
+	printf("   M-cycle  bank:PC   bytes     instruction       AF   BC   DE   HL   SP   IE IF\n");
+	for (const trace_record& r : records) {
+		char text[32], bytes[16];
+		int len = disassemble(text, sizeof(text), r.pc, r.op, r.imm);
+		if (len == 1)
+			snprintf(bytes, sizeof(bytes), "%02X", r.op);
+		else if (len == 2)
+			snprintf(bytes, sizeof(bytes), "%02X %02X", r.op, r.imm & 0xFF);
+		else
+			snprintf(bytes, sizeof(bytes), "%02X %02X %02X", r.op, r.imm & 0xFF, r.imm >> 8);
+		if (r.flags & TRACE_INTERRUPT)
+			printf("           -- interrupt --\n");
+		if (r.pc >= 0x4000 && r.pc < 0x8000)
+			printf("%10u  %02X:%04X  ", r.cycles, r.bank, r.pc);
+		else
+			printf("%10u     %04X  ", r.cycles, r.pc);
+		printf("%-8s  %-16s  %02X%02X %04X %04X %04X %04X %02X %02X\n",
+		       bytes, text, r.a, r.f, r.bc, r.de, r.hl, r.sp, r.ie, r.if_);
+	}
+	return 0;
+}
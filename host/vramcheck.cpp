@@ -0,0 +1,105 @@
+/*
+ * VRAM dirty bitmap check for the Linux host build.
+ *
+ *   vramcheck
+ *
+ * Writes tile data and both tile maps through mem_write_byte(), the path
+ * the CPU uses, and checks that mem_vram_consume() and
+ * mem_vram_consume_map_row() report exactly the tiles and entries that
+ * changed, that writing a byte's current value marks nothing and that
+ * consuming clears the bits. Prints each failed check; the exit status is
+ * the number of them. See MEM_VRAM_DIRTY in espeon/mem.h.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "Arduino.h"
+#include "host.h"
+#include "../espeon/mem.h"
+
+static int failures;
+
+static void check(bool ok, const char* what)
+{
+	if (!ok) {
+		printf("FAIL    %s\n", what);
+		failures++;
+	}
+}
+
+static int count_bits(const uint32_t* words, int n)
+{
+	int bits = 0;
+	for (int w = 0; w < n; w++)
+		bits += __builtin_popcount(words[w]);
+	return bits;
+}
+
+static bool map_dirty(const struct vram_dirty* d, int map, int entry)
+{
+	int i = map * 1024 + entry;
+	return d->map[i >> 5] & (1u << (i & 31));
+}
+
+int main(void)
+{
+	/* JR -2, the CPU never runs here anyway */
+	static const uint8_t program[] = { 0x18, 0xFE };
+	struct vram_dirty d;
+	size_t size;
+
+	Serial.quiet = true;
+	uint8_t* rom = host_make_rom(program, sizeof(program), &size);
+	host_set_rom(rom, size);
+	if (!host_init_emulator()) {
+		fprintf(stderr, "vramcheck: emulator init failed\n");
+		return 1;
+	}
+
+	/* mmu_init() just cleared VRAM: everything is dirty once */
+	check(mem_vram_consume(&d), "everything dirty after init");
+	check(count_bits(d.tiles, 384 / 32) == 384 && count_bits(d.map, 2048 / 32) == 2048,
+	      "all 384 tiles and 2048 map entries dirty after init");
+	check(!mem_vram_consume(&d), "nothing dirty after consuming");
+
+	/* The same value as what's there marks nothing */
+	mem_write_byte(0x8000, 0x00);
+	mem_write_byte(0x9800, 0x00);
+	mem_write_byte(0x9FFF, 0x00);
+	check(!mem_vram_consume(&d), "unchanged writes mark nothing");
+
+	/* Tile 0 (first byte), tile 1 (last byte), tile 383 (0x97F0) twice,
+	 * tile 255 written back to its old value */
+	mem_write_byte(0x8000, 0x11);
+	mem_write_byte(0x801F, 0x22);
+	mem_write_byte(0x97F0, 0x33);
+	mem_write_byte(0x97FF, 0x44);
+	mem_write_byte(0x8FF0, 0x55);
+	mem_write_byte(0x8FF0, 0x00);
+	/* Map 0 entries 0 and 1023, map 1 entry 33 (row 1, column 1) */
+	mem_write_byte(0x9800, 0x01);
+	mem_write_byte(0x9BFF, 0x02);
+	mem_write_byte(0x9C21, 0x03);
+
+	check(mem_vram_consume(&d), "writes mark something");
+	check(mem_vram_tile_dirty(&d, 0) && mem_vram_tile_dirty(&d, 1) && mem_vram_tile_dirty(&d, 383),
+	      "tiles 0, 1 and 383 dirty");
+	check(mem_vram_tile_dirty(&d, 255), "tile 255 dirty after a change and change back");
+	check(count_bits(d.tiles, 384 / 32) == 4, "exactly 4 tiles dirty");
+	check(map_dirty(&d, 0, 0) && map_dirty(&d, 0, 1023) && map_dirty(&d, 1, 33),
+	      "map 0 entries 0 and 1023, map 1 entry 33 dirty");
+	check(count_bits(d.map, 2048 / 32) == 3, "exactly 3 map entries dirty");
+	check(mem_get_byte(0x801F) == 0x22 && mem_get_byte(0x9C21) == 0x03, "written bytes read back");
+	check(!mem_vram_consume(&d) && count_bits(d.tiles, 384 / 32) == 0 && count_bits(d.map, 2048 / 32) == 0,
+	      "consuming clears the bits");
+
+	/* Per line: one map row is one word, the other rows stay pending */
+	mem_write_byte(0x9C21, 0x04);
+	mem_write_byte(0x9C40, 0x05);
+	check(mem_vram_consume_map_row(1, 1) == 0x00000002, "map 1 row 1 has entry 1 dirty");
+	check(mem_vram_consume_map_row(1, 1) == 0, "map 1 row 1 clear after consuming it");
+	check(mem_vram_consume(&d) && count_bits(d.map, 2048 / 32) == 1 && map_dirty(&d, 1, 64),
+	      "map 1 row 2 still pending");
+
+	printf("%s, %d failed\n", failures ? "FAIL" : "PASS", failures);
+	return failures;
+}